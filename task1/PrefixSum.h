@@ -0,0 +1,329 @@
+#ifndef PREFIX_SUM_H
+#define PREFIX_SUM_H
+
+#include <iostream>
+#include <thread>
+#include <vector>
+#include <functional>
+#include <cmath>
+#include <cstdint>
+
+#ifdef __linux__
+#include <unistd.h>
+#include <sys/mman.h>
+#endif
+
+#include "ThreadPool.h"
+#include "TaskGraph.h"
+#include "Scan.h"
+#include "SegmentedScan.h"
+#include <QThreadPool>
+#include <QtConcurrent>
+
+// The prefix sum variants compared by main.cpp and benchmark.cpp. Each one
+// that runs on a pool takes it as a parameter, so the benchmark can sweep
+// thread counts without timing pool start-up; the overloads without a pool
+// build the one the variant is tuned for. The Blelloch variants need a
+// power of two size and leave the exclusive scan in arr, the others say
+// which scan they produce.
+
+// pool for parallelPrefixSum: levels follow each other back to back, so
+// keep the workers awake between them, and with Static partitioning worker
+// r always sweeps the same slice of arr on the same core
+inline ThreadPool::Options sweepPoolOptions(size_t threads)
+{
+    ThreadPool::Options options(threads);
+    options.affinity = ThreadPool::Affinity::Cores;
+    options.spin = 2000;
+    options.yield = 50;
+    return options;
+}
+
+// arr = source, each block of the blocked scans (Scan.h) written by the
+// worker that scans it, Static chunk b on worker b. The whole pages of arr
+// are given back to the kernel first, so these writes are their first
+// touch: on a NUMA machine, with affinity set, every block then lives on
+// the node of its worker, and the scans route it there by its address.
+inline void placedCopy(ThreadPool& pool, const std::vector<double>& source, std::vector<double>& arr)
+{
+    arr.resize(source.size());
+#ifdef __linux__
+    uintptr_t page = sysconf(_SC_PAGESIZE);
+    uintptr_t begin = (reinterpret_cast<uintptr_t>(arr.data()) + page - 1) & ~(page - 1);
+    uintptr_t end = reinterpret_cast<uintptr_t>(arr.data() + arr.size()) & ~(page - 1);
+    // private memory reads as zero after this, and is placed again when written
+    if(begin < end)
+        madvise(reinterpret_cast<void*>(begin), end - begin, MADV_DONTNEED);
+#endif
+    size_t size = source.size();
+    size_t blocks = std::min(pool.size(), size);
+    pool.parallel_range(size_t(0), blocks, size_t(1), [&](size_t b, size_t e)
+    {
+        std::copy(source.begin() + size*b/blocks, source.begin() + size*e/blocks, arr.begin() + size*b/blocks);
+    }, ThreadPool::Partition::Static);
+}
+
+// with statsOut set, pool statistics of each sweep are written there as
+// one JSON line per phase
+inline void parallelPrefixSum(ThreadPool& pool, std::vector<double>& arr, std::ostream* statsOut = nullptr)
+{
+    size_t size = arr.size();
+    pool.enable_stats(statsOut != nullptr);
+
+    size_t depth = std::log2 (size);
+    for(size_t d = 0; d < depth; ++d) {
+
+        size_t works = size_t(1) << (depth - d - 1);
+        size_t arraySize = size_t(2) << d;
+
+        pool.parallel_for(size_t(0), works, size_t(0),
+            [arraySize, &arr](size_t k)
+            {
+                size_t arrayStart = k*arraySize;
+                arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
+            }, ThreadPool::Partition::Static);
+    }
+
+    if(statsOut)
+    {
+        *statsOut << "{\"phase\":\"up-sweep\",\"pool\":" << pool.stats().to_json() << "}" << std::endl;
+        pool.reset_stats();
+    }
+
+    arr[size-1] = 0;
+
+    for(int d = depth-1; d >= 0; --d) {
+
+        size_t works = size_t(1) << (depth - d - 1);
+        size_t arraySize = size_t(2) << d;
+
+        pool.parallel_for(size_t(0), works, size_t(0),
+            [arraySize, &arr](size_t k)
+            {
+                size_t arrayStart = k*arraySize;
+                double temp =  arr[arrayStart + arraySize - 1];
+                arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
+                arr[arrayStart + arraySize/2 - 1] = temp;
+            }, ThreadPool::Partition::Static);
+    }
+
+    if(statsOut)
+    {
+        *statsOut << "{\"phase\":\"down-sweep\",\"pool\":" << pool.stats().to_json() << "}" << std::endl;
+        pool.enable_stats(false);
+    }
+}
+
+inline void parallelPrefixSum(std::vector<double>& arr, std::ostream* statsOut = nullptr)
+{
+    ThreadPool pool(sweepPoolOptions(std::thread::hardware_concurrency()));
+    parallelPrefixSum(pool, arr, statsOut);
+}
+
+// Blelloch up-sweep / down-sweep restricted to [first, first + size)
+inline void upSweep(std::vector<double>& arr, size_t first, size_t size)
+{
+    for(size_t stride = 2; stride <= size; stride *= 2)
+        for(size_t k = first; k < first + size; k += stride)
+            arr[k + stride - 1] += arr[k + stride/2 - 1];
+}
+
+inline void downSweep(std::vector<double>& arr, size_t first, size_t size)
+{
+    for(size_t stride = size; stride >= 2; stride /= 2)
+        for(size_t k = first; k < first + size; k += stride)
+        {
+            double temp = arr[k + stride - 1];
+            arr[k + stride - 1] += arr[k + stride/2 - 1];
+            arr[k + stride/2 - 1] = temp;
+        }
+}
+
+// Same tree as parallelPrefixSum, but each node of the tree is a task that
+// starts as soon as its children (up-sweep) or its parent (down-sweep) are
+// done, instead of waiting for the whole level. The bottom levels are cut
+// into blocks that are swept serially by one task each.
+inline void parallelGraphPrefixSum(ThreadPool& pool, std::vector<double>& arr)
+{
+    size_t size = arr.size();
+
+    size_t block = size_t(1) << 14;
+    if(size <= block)
+    {
+        upSweep(arr, 0, size);
+        arr[size-1] = 0;
+        downSweep(arr, 0, size);
+        return;
+    }
+
+    TaskGraph graph(pool);
+    size_t blocks = size / block;
+
+    // up[level][k] covers [k*2^level*block, (k+1)*2^level*block)
+    std::vector< std::vector<TaskGraph::Node> > up(1);
+    for(size_t k = 0; k < blocks; ++k)
+        up[0].push_back(graph.emplace([&arr, k, block]{ upSweep(arr, k*block, block); }));
+    for(size_t level = 1; (blocks >> level) > 0; ++level)
+    {
+        size_t arraySize = block << level;
+        up.emplace_back();
+        for(size_t k = 0; k < (blocks >> level); ++k)
+        {
+            size_t arrayStart = k*arraySize;
+            TaskGraph::Node node = graph.emplace([&arr, arrayStart, arraySize]
+            {
+                arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
+            });
+            node.succeed(up[level-1][2*k]).succeed(up[level-1][2*k+1]);
+            up[level].push_back(node);
+        }
+    }
+
+    TaskGraph::Node root = up.back()[0].then([&arr, size]{ arr[size-1] = 0; });
+
+    std::vector<TaskGraph::Node> parents(1, root);
+    for(size_t level = up.size() - 1; level > 0; --level)
+    {
+        size_t arraySize = block << level;
+        std::vector<TaskGraph::Node> nodes;
+        for(size_t k = 0; k < (blocks >> level); ++k)
+        {
+            size_t arrayStart = k*arraySize;
+            nodes.push_back(parents[k/2].then([&arr, arrayStart, arraySize]
+            {
+                double temp = arr[arrayStart + arraySize - 1];
+                arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
+                arr[arrayStart + arraySize/2 - 1] = temp;
+            }));
+        }
+        parents.swap(nodes);
+    }
+    for(size_t k = 0; k < blocks; ++k)
+        parents[k/2].then([&arr, k, block]{ downSweep(arr, k*block, block); });
+
+    graph.run();
+}
+
+inline void parallelGraphPrefixSum(std::vector<double>& arr)
+{
+    ThreadPool pool(std::thread::hardware_concurrency());
+    parallelGraphPrefixSum(pool, arr);
+}
+
+// one QtConcurrent task per tree node, so only usable for small arrays
+inline void parallelQtPrefixSum(QThreadPool* pool, std::vector<double>& arr)
+{
+    size_t size = arr.size();
+    std::vector< QFuture<void> > results;
+
+    size_t depth = std::log2 (size);
+    for(size_t d = 0; d < depth; ++d) {
+
+        size_t works = size_t(1) << (depth - d - 1);
+
+        for(size_t k = 0; k < works; ++k)
+        {
+            results.push_back(QtConcurrent::run(pool, [d, k, &arr]
+            {
+                size_t arraySize = size_t(2) << d;
+                size_t arrayStart = k*arraySize;
+                arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
+                return;
+            }));
+        }
+        for(auto && result: results)
+            result.waitForFinished();
+        results.clear();
+    }
+
+    arr[size-1] = 0;
+
+    for(int d = depth-1; d >= 0; --d) {
+
+        size_t works = size_t(1) << (depth - d - 1);
+
+        for(size_t k = 0; k < works; ++k)
+        {
+            results.push_back(QtConcurrent::run(pool, [d, k, &arr]
+            {
+                size_t arraySize = size_t(2) << d;
+                size_t arrayStart = k*arraySize;
+                double temp =  arr[arrayStart + arraySize - 1];
+                arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
+                arr[arrayStart + arraySize/2 - 1] = temp;
+                return;
+            }));
+        }
+        for(auto && result: results)
+            result.waitForFinished();
+        results.clear();
+    }
+
+}
+
+inline void parallelQtPrefixSum(std::vector<double>& arr)
+{
+    parallelQtPrefixSum(QThreadPool::globalInstance(), arr);
+}
+
+// exclusive, reduce-then-scan over one block per thread, see Scan.h
+inline void blockedPrefixSum(ThreadPool& pool, std::vector<double>& arr)
+{
+    exclusiveScan(pool, arr.data(), arr.data() + arr.size(), arr.data(), 0.0);
+}
+
+inline void blockedPrefixSum(std::vector<double>& arr)
+{
+    ThreadPool::Options options(std::thread::hardware_concurrency());
+    options.affinity = ThreadPool::Affinity::Cores;
+    ThreadPool pool(options);
+    blockedPrefixSum(pool, arr);
+}
+
+// exclusive, single pass over memory, see ScanStrategy::DecoupledLookBack
+inline void lookBackPrefixSum(ThreadPool& pool, std::vector<double>& arr)
+{
+    exclusiveScan(pool, arr.data(), arr.data() + arr.size(), arr.data(), 0.0,
+                  std::plus<double>(), ScanStrategy::DecoupledLookBack);
+}
+
+inline void lookBackPrefixSum(std::vector<double>& arr)
+{
+    ThreadPool pool(std::thread::hardware_concurrency());
+    lookBackPrefixSum(pool, arr);
+}
+
+// inclusive, single core, SIMD kernel from ScanKernels.h
+inline void simdPrefixSum(std::vector<double>& arr)
+{
+    simdInclusiveScan(arr.data(), arr.data(), arr.size(), 0.0);
+}
+
+// inclusive prefix sums of the series packed back to back in arr, a new
+// one starting wherever heads[i] is set; see SegmentedScan.h
+inline void segmentedPrefixSum(ThreadPool& pool, std::vector<double>& arr, const std::vector<uint8_t>& heads)
+{
+    segmentedInclusiveScan(pool, arr.data(), arr.data() + arr.size(), heads.data(), arr.data());
+}
+
+// segment lengths are drawn from lengths()
+template<class Lengths>
+void segmentedPrefixSum(std::vector<double>& arr, Lengths lengths)
+{
+    std::vector<uint8_t> heads(arr.size());
+    for(size_t i = 0; i < arr.size(); i += lengths())
+        heads[i] = 1;
+    ThreadPool pool(std::thread::hardware_concurrency());
+    segmentedPrefixSum(pool, arr, heads);
+}
+
+// inclusive, the reference loop
+inline void normalPrefixSum(std::vector<double>& arr)
+{
+    for (size_t i = 1; i < arr.size(); ++i)
+    {
+        arr[i] += arr[i-1];
+    }
+}
+
+#endif
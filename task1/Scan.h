@@ -0,0 +1,328 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <type_traits>
+#include <cstddef>
+#include <cstdint>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <exception>
+
+#include "ThreadPool.h"
+#include "ScanKernels.h"
+
+// Bandwidth-optimal parallel scan (reduce-then-scan). The input is cut into
+// one contiguous block per worker:
+//   1. every block is reduced to its total            (read n)
+//   2. the block totals are scanned on the caller     (one value per block)
+//   3. every block is scanned again, starting from    (read n, write n)
+//      the carry of the blocks before it
+// so memory is streamed twice in total instead of O(log n) strided passes.
+// op must be associative; in-place use (out == first) is allowed. On a
+// pool spread over several NUMA nodes, steps 1 and 3 run every block on
+// the node holding its memory.
+
+// below this many elements a scan is not worth waking the pool for
+const size_t scanSerialCutoff = size_t(1) << 15;
+
+// serial kernels, the inner loops of the blocked scan; sums over the types
+// ScanKernels.h covers go to the SIMD kernels, everything else to a loop
+template<class T, class Op> struct HasSimdScan : std::false_type {};
+template<> struct HasSimdScan<double, std::plus<double> > : std::true_type {};
+template<> struct HasSimdScan<float, std::plus<float> > : std::true_type {};
+template<> struct HasSimdScan<int32_t, std::plus<int32_t> > : std::true_type {};
+template<> struct HasSimdScan<int64_t, std::plus<int64_t> > : std::true_type {};
+
+template<class T, class Op>
+T serialReduce(const T* first, const T* last, Op op, std::false_type)
+{
+    T acc = *first;
+    for(const T* it = first + 1; it != last; ++it)
+        acc = op(acc, *it);
+    return acc;
+}
+
+template<class T, class Op>
+T serialReduce(const T* first, const T* last, Op, std::true_type)
+{
+    return simdReduce(first, last - first);
+}
+
+template<class T, class Op>
+T serialReduce(const T* first, const T* last, Op op)
+{
+    return serialReduce(first, last, op, HasSimdScan<T, Op>());
+}
+
+template<class T, class Op>
+void serialInclusiveScan(const T* first, const T* last, T* out, T carry, Op op, std::false_type)
+{
+    for(; first != last; ++first, ++out)
+    {
+        carry = op(carry, *first);
+        *out = carry;
+    }
+}
+
+template<class T, class Op>
+void serialInclusiveScan(const T* first, const T* last, T* out, T carry, Op, std::true_type)
+{
+    simdInclusiveScan(first, out, last - first, carry);
+}
+
+// out[i] = carry op first[0] op ... op first[i]
+template<class T, class Op>
+void serialInclusiveScan(const T* first, const T* last, T* out, T carry, Op op)
+{
+    serialInclusiveScan(first, last, out, carry, op, HasSimdScan<T, Op>());
+}
+
+// out[0] = first[0], out[i] = out[i-1] op first[i]
+template<class T, class Op>
+void serialInclusiveScan(const T* first, const T* last, T* out, Op op)
+{
+    if(first == last)
+        return;
+    T carry = *first;
+    *out = carry;
+    serialInclusiveScan(first + 1, last, out + 1, carry, op);
+}
+
+template<class T, class Op>
+void serialExclusiveScan(const T* first, const T* last, T* out, T carry, Op op, std::false_type)
+{
+    for(; first != last; ++first, ++out)
+    {
+        T value = *first;
+        *out = carry;
+        carry = op(carry, value);
+    }
+}
+
+template<class T, class Op>
+void serialExclusiveScan(const T* first, const T* last, T* out, T carry, Op, std::true_type)
+{
+    simdExclusiveScan(first, out, last - first, carry);
+}
+
+// out[i] = carry op first[0] op ... op first[i-1]
+template<class T, class Op>
+void serialExclusiveScan(const T* first, const T* last, T* out, T carry, Op op)
+{
+    serialExclusiveScan(first, last, out, carry, op, HasSimdScan<T, Op>());
+}
+
+// how the parallel scans split the work:
+// ReduceThenScan    - the blocked scheme above, reads the input twice
+// DecoupledLookBack - single pass (Merrill & Garland, "Single-pass Parallel
+//                     Prefix Scan with Decoupled Look-back"): cache-sized
+//                     tiles are claimed in order through an atomic counter,
+//                     each publishes its aggregate and then its inclusive
+//                     prefix, and finds its own carry by looking back over
+//                     the flags of its predecessors instead of waiting for
+//                     a global barrier. The reduce and the scan of a tile
+//                     both hit cache, so memory is read once.
+enum class ScanStrategy { ReduceThenScan, DecoupledLookBack };
+
+// tiles of the look-back scan, sized to stay in L2 between its two passes
+const size_t scanTileBytes = size_t(1) << 17;
+
+// scans one block with the carry of everything before it; carry is
+// nullptr only for the first block of an inclusive scan without init
+template<class T, class Op>
+void scanBlock(const T* first, const T* last, T* out, const T* carry, bool exclusive, Op op)
+{
+    if(exclusive)
+        serialExclusiveScan(first, last, out, *carry, op);
+    else if(carry)
+        serialInclusiveScan(first, last, out, *carry, op);
+    else
+        serialInclusiveScan(first, last, out, op);
+}
+
+// Runs fn(b) for every block b of the blocked scan, block b being
+// [first + size*b/blocks, first + size*(b+1)/blocks). On a pool placed
+// over several NUMA nodes each block goes to a worker of the node its
+// first page lives on, so it is read from local memory wherever it was
+// first touched. Otherwise block b is Static chunk b, worker b with
+// affinity set.
+template<class T, class F>
+void forEachBlock(ThreadPool& pool, const T* first, size_t size, size_t blocks, F fn)
+{
+    if(!pool.spans_nodes())
+    {
+        pool.parallel_range(size_t(0), blocks, size_t(1), [&](size_t b, size_t e)
+        {
+            for(; b < e; ++b)
+                fn(b);
+        }, ThreadPool::Partition::Static);
+        return;
+    }
+
+    Latch done(blocks);
+    std::exception_ptr error;
+    std::mutex errorMutex;
+    for(size_t b = 0; b < blocks; ++b)
+        pool.post_on_node(ThreadPool::node_of(first + size*b/blocks), [&, b]
+        {
+            try {
+                fn(b);
+            } catch(...) {
+                std::unique_lock<std::mutex> lock(errorMutex);
+                if(!error)
+                    error = std::current_exception();
+            }
+            done.count_down();
+        });
+    pool.wait(done);
+    if(error)
+        std::rethrow_exception(error);
+}
+
+template<class T, class Op>
+void reduceThenScan(ThreadPool& pool, const T* first, size_t size, T* out, const T* init,
+                    bool exclusive, Op op)
+{
+    // phase 1: block totals, one block per worker
+    size_t blocks = std::min(pool.size(), size);
+    std::vector<T> total(blocks);
+    forEachBlock(pool, first, size, blocks, [&](size_t b)
+    {
+        total[b] = serialReduce(first + size*b/blocks, first + size*(b+1)/blocks, op);
+    });
+
+    // phase 2: carry[b] is init op the totals of blocks 0..b-1; without init
+    // the first block has no carry and carry[0] stays unset
+    std::vector<T> carry(blocks);
+    size_t b = 0;
+    T acc = init ? *init : total[b++];
+    for(; b < blocks; ++b)
+    {
+        carry[b] = acc;
+        acc = op(acc, total[b]);
+    }
+
+    // phase 3
+    forEachBlock(pool, first, size, blocks, [&](size_t b)
+    {
+        scanBlock(first + size*b/blocks, first + size*(b+1)/blocks, out + size*b/blocks,
+                  b == 0 && !init ? nullptr : &carry[b], exclusive, op);
+    });
+}
+
+template<class T>
+struct LookBackTile {
+    enum { Invalid, Aggregate, Prefix };
+    // written once each, then published by a release store of status
+    std::atomic<int> status;
+    T aggregate;
+    T prefix;
+
+    LookBackTile() : status(Invalid) {}
+};
+
+template<class T, class Op>
+void lookBackScan(ThreadPool& pool, const T* first, size_t size, T* out, const T* init,
+                  bool exclusive, Op op)
+{
+    size_t tileSize = std::max<size_t>(1, scanTileBytes / sizeof(T));
+    size_t tiles = (size + tileSize - 1) / tileSize;
+    std::vector< LookBackTile<T> > state(tiles);
+    std::atomic<size_t> nextTile(0);
+
+    // a tile is only claimed by a running thread and never waits on a later
+    // one, so the look-back always makes progress, even on a single worker
+    auto runner = [&](size_t, size_t)
+    {
+        for(;;)
+        {
+            size_t t = nextTile.fetch_add(1);
+            if(t >= tiles)
+                return;
+            const T* tileFirst = first + t*tileSize;
+            const T* tileLast = first + std::min(size, (t + 1)*tileSize);
+            T* tileOut = out + t*tileSize;
+            LookBackTile<T>& tile = state[t];
+
+            if(t == 0)
+            {
+                T total = serialReduce(tileFirst, tileLast, op);
+                tile.prefix = init ? op(*init, total) : total;
+                tile.status.store(LookBackTile<T>::Prefix, std::memory_order_release);
+                scanBlock(tileFirst, tileLast, tileOut, init, exclusive, op);
+                continue;
+            }
+
+            tile.aggregate = serialReduce(tileFirst, tileLast, op);
+            tile.status.store(LookBackTile<T>::Aggregate, std::memory_order_release);
+
+            // walk back, folding aggregates in, until some tile has its prefix
+            T carry = T();
+            bool haveCarry = false;
+            for(size_t j = t; j-- > 0; )
+            {
+                int status;
+                while((status = state[j].status.load(std::memory_order_acquire)) == LookBackTile<T>::Invalid)
+                    std::this_thread::yield();
+                const T& value = status == LookBackTile<T>::Prefix ? state[j].prefix : state[j].aggregate;
+                carry = haveCarry ? op(value, carry) : value;
+                haveCarry = true;
+                if(status == LookBackTile<T>::Prefix)
+                    break;
+            }
+
+            tile.prefix = op(carry, tile.aggregate);
+            tile.status.store(LookBackTile<T>::Prefix, std::memory_order_release);
+            scanBlock(tileFirst, tileLast, tileOut, &carry, exclusive, op);
+        }
+    };
+    pool.parallel_range(size_t(0), std::min(pool.size(), tiles), size_t(1), runner);
+}
+
+// init is the carry in from before first, nullptr if there is none
+template<class T, class Op>
+void parallelScan(ThreadPool& pool, const T* first, const T* last, T* out, const T* init,
+                  bool exclusive, Op op, ScanStrategy strategy)
+{
+    size_t size = last - first;
+    if(size < scanSerialCutoff || pool.size() == 1)
+    {
+        if(size > 0)
+            scanBlock(first, last, out, init, exclusive, op);
+        return;
+    }
+
+    if(strategy == ScanStrategy::DecoupledLookBack)
+        lookBackScan(pool, first, size, out, init, exclusive, op);
+    else
+        reduceThenScan(pool, first, size, out, init, exclusive, op);
+}
+
+template<class T, class Op = std::plus<T> >
+void inclusiveScan(ThreadPool& pool, const T* first, const T* last, T* out, Op op = Op(),
+                   ScanStrategy strategy = ScanStrategy::ReduceThenScan)
+{
+    parallelScan(pool, first, last, out, static_cast<const T*>(nullptr), false, op, strategy);
+}
+
+// out[i] = init op first[0] op ... op first[i], for scans continued from
+// an earlier piece of the same sequence
+template<class T, class Op>
+void inclusiveScan(ThreadPool& pool, const T* first, const T* last, T* out, T init, Op op,
+                   ScanStrategy strategy = ScanStrategy::ReduceThenScan)
+{
+    parallelScan(pool, first, last, out, &init, false, op, strategy);
+}
+
+template<class T, class Op = std::plus<T> >
+void exclusiveScan(ThreadPool& pool, const T* first, const T* last, T* out, T init, Op op = Op(),
+                   ScanStrategy strategy = ScanStrategy::ReduceThenScan)
+{
+    parallelScan(pool, first, last, out, &init, true, op, strategy);
+}
+
+#endif
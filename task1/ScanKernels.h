@@ -0,0 +1,460 @@
+#ifndef SCAN_KERNELS_H
+#define SCAN_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Serial SIMD prefix-sum kernels for double, float, int32_t and int64_t.
+// Each vector is scanned in registers in log2(lanes) shift-and-add steps,
+// the running carry is added as a broadcast vector, and its last lane
+// becomes the next carry. The widest of SSE2, AVX2 and AVX-512 the CPU
+// supports is picked at run time; other compilers and architectures get
+// the scalar loop.
+//
+// Floating point sums are associated differently from the plain loop, so
+// results can differ from it in the last bits.
+
+enum class SimdLevel { Scalar, SSE2, AVX2, AVX512 };
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define SCAN_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+inline SimdLevel detectSimdLevel()
+{
+#ifdef SCAN_KERNELS_X86
+    __builtin_cpu_init();
+    if(__builtin_cpu_supports("avx512f"))
+        return SimdLevel::AVX512;
+    if(__builtin_cpu_supports("avx2"))
+        return SimdLevel::AVX2;
+    if(__builtin_cpu_supports("sse2"))
+        return SimdLevel::SSE2;
+#endif
+    return SimdLevel::Scalar;
+}
+
+inline SimdLevel simdLevel()
+{
+    static const SimdLevel level = detectSimdLevel();
+    return level;
+}
+
+inline const char* simdLevelName(SimdLevel level)
+{
+    switch(level) {
+    case SimdLevel::SSE2: return "sse2";
+    case SimdLevel::AVX2: return "avx2";
+    case SimdLevel::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+template<class T>
+T scalarInclusiveScan(const T* in, T* out, size_t n, T carry)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        carry += in[i];
+        out[i] = carry;
+    }
+    return carry;
+}
+
+template<class T>
+T scalarExclusiveScan(const T* in, T* out, size_t n, T carry)
+{
+    for(size_t i = 0; i < n; ++i)
+    {
+        T value = in[i];
+        out[i] = carry;
+        carry += value;
+    }
+    return carry;
+}
+
+template<class T>
+T scalarReduce(const T* in, size_t n)
+{
+    T acc = T();
+    for(size_t i = 0; i < n; ++i)
+        acc += in[i];
+    return acc;
+}
+
+#ifdef SCAN_KERNELS_X86
+
+// Per ISA and element type: Vec, lanes, loadu/storeu/add/set1,
+// prefix(x) - inclusive scan of the lanes of x,
+// shift1(x) - lanes moved up by one, lane 0 zeroed,
+// last(x)   - last lane broadcast to all lanes.
+template<class T> struct Sse2Ops;
+template<class T> struct Avx2Ops;
+template<class T> struct Avx512Ops;
+
+#define SCAN_SSE2 __attribute__((target("sse2")))
+#define SCAN_AVX2 __attribute__((target("avx2")))
+#define SCAN_AVX512 __attribute__((target("avx512f")))
+
+template<> struct Sse2Ops<double> {
+    typedef __m128d Vec;
+    static const size_t lanes = 2;
+    SCAN_SSE2 static Vec loadu(const double* p) { return _mm_loadu_pd(p); }
+    SCAN_SSE2 static void storeu(double* p, Vec x) { _mm_storeu_pd(p, x); }
+    SCAN_SSE2 static Vec add(Vec a, Vec b) { return _mm_add_pd(a, b); }
+    SCAN_SSE2 static Vec set1(double v) { return _mm_set1_pd(v); }
+    SCAN_SSE2 static Vec shift1(Vec x)
+    {
+        return _mm_castsi128_pd(_mm_slli_si128(_mm_castpd_si128(x), 8));
+    }
+    SCAN_SSE2 static Vec prefix(Vec x) { return add(x, shift1(x)); }
+    SCAN_SSE2 static Vec last(Vec x) { return _mm_unpackhi_pd(x, x); }
+};
+
+template<> struct Sse2Ops<float> {
+    typedef __m128 Vec;
+    static const size_t lanes = 4;
+    SCAN_SSE2 static Vec loadu(const float* p) { return _mm_loadu_ps(p); }
+    SCAN_SSE2 static void storeu(float* p, Vec x) { _mm_storeu_ps(p, x); }
+    SCAN_SSE2 static Vec add(Vec a, Vec b) { return _mm_add_ps(a, b); }
+    SCAN_SSE2 static Vec set1(float v) { return _mm_set1_ps(v); }
+    SCAN_SSE2 static Vec shift1(Vec x)
+    {
+        return _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 4));
+    }
+    SCAN_SSE2 static Vec prefix(Vec x)
+    {
+        x = add(x, shift1(x));
+        return add(x, _mm_castsi128_ps(_mm_slli_si128(_mm_castps_si128(x), 8)));
+    }
+    SCAN_SSE2 static Vec last(Vec x) { return _mm_shuffle_ps(x, x, 0xFF); }
+};
+
+template<> struct Sse2Ops<int32_t> {
+    typedef __m128i Vec;
+    static const size_t lanes = 4;
+    SCAN_SSE2 static Vec loadu(const int32_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    SCAN_SSE2 static void storeu(int32_t* p, Vec x) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x); }
+    SCAN_SSE2 static Vec add(Vec a, Vec b) { return _mm_add_epi32(a, b); }
+    SCAN_SSE2 static Vec set1(int32_t v) { return _mm_set1_epi32(v); }
+    SCAN_SSE2 static Vec shift1(Vec x) { return _mm_slli_si128(x, 4); }
+    SCAN_SSE2 static Vec prefix(Vec x)
+    {
+        x = add(x, shift1(x));
+        return add(x, _mm_slli_si128(x, 8));
+    }
+    SCAN_SSE2 static Vec last(Vec x) { return _mm_shuffle_epi32(x, 0xFF); }
+};
+
+template<> struct Sse2Ops<int64_t> {
+    typedef __m128i Vec;
+    static const size_t lanes = 2;
+    SCAN_SSE2 static Vec loadu(const int64_t* p) { return _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)); }
+    SCAN_SSE2 static void storeu(int64_t* p, Vec x) { _mm_storeu_si128(reinterpret_cast<__m128i*>(p), x); }
+    SCAN_SSE2 static Vec add(Vec a, Vec b) { return _mm_add_epi64(a, b); }
+    SCAN_SSE2 static Vec set1(int64_t v) { return _mm_set1_epi64x(v); }
+    SCAN_SSE2 static Vec shift1(Vec x) { return _mm_slli_si128(x, 8); }
+    SCAN_SSE2 static Vec prefix(Vec x) { return add(x, shift1(x)); }
+    SCAN_SSE2 static Vec last(Vec x) { return _mm_unpackhi_epi64(x, x); }
+};
+
+template<> struct Avx2Ops<double> {
+    typedef __m256d Vec;
+    static const size_t lanes = 4;
+    SCAN_AVX2 static Vec loadu(const double* p) { return _mm256_loadu_pd(p); }
+    SCAN_AVX2 static void storeu(double* p, Vec x) { _mm256_storeu_pd(p, x); }
+    SCAN_AVX2 static Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+    SCAN_AVX2 static Vec set1(double v) { return _mm256_set1_pd(v); }
+    SCAN_AVX2 static Vec shift1(Vec x)
+    {
+        // [x0 x0 x1 x2] with lane 0 cleared
+        return _mm256_blend_pd(_mm256_permute4x64_pd(x, 0x90), _mm256_setzero_pd(), 0x1);
+    }
+    SCAN_AVX2 static Vec prefix(Vec x)
+    {
+        x = add(x, shift1(x));
+        // [0 0 x0 x1]
+        return add(x, _mm256_permute2f128_pd(x, x, 0x08));
+    }
+    SCAN_AVX2 static Vec last(Vec x) { return _mm256_permute4x64_pd(x, 0xFF); }
+};
+
+template<> struct Avx2Ops<int64_t> {
+    typedef __m256i Vec;
+    static const size_t lanes = 4;
+    SCAN_AVX2 static Vec loadu(const int64_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    SCAN_AVX2 static void storeu(int64_t* p, Vec x) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x); }
+    SCAN_AVX2 static Vec add(Vec a, Vec b) { return _mm256_add_epi64(a, b); }
+    SCAN_AVX2 static Vec set1(int64_t v) { return _mm256_set1_epi64x(v); }
+    SCAN_AVX2 static Vec shift1(Vec x)
+    {
+        return _mm256_blend_epi32(_mm256_permute4x64_epi64(x, 0x90), _mm256_setzero_si256(), 0x03);
+    }
+    SCAN_AVX2 static Vec prefix(Vec x)
+    {
+        x = add(x, shift1(x));
+        return add(x, _mm256_permute2x128_si256(x, x, 0x08));
+    }
+    SCAN_AVX2 static Vec last(Vec x) { return _mm256_permute4x64_epi64(x, 0xFF); }
+};
+
+template<> struct Avx2Ops<float> {
+    typedef __m256 Vec;
+    static const size_t lanes = 8;
+    SCAN_AVX2 static Vec loadu(const float* p) { return _mm256_loadu_ps(p); }
+    SCAN_AVX2 static void storeu(float* p, Vec x) { _mm256_storeu_ps(p, x); }
+    SCAN_AVX2 static Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+    SCAN_AVX2 static Vec set1(float v) { return _mm256_set1_ps(v); }
+    SCAN_AVX2 static Vec shift1(Vec x)
+    {
+        Vec moved = _mm256_permutevar8x32_ps(x, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6));
+        return _mm256_blend_ps(moved, _mm256_setzero_ps(), 0x01);
+    }
+    SCAN_AVX2 static Vec prefix(Vec x)
+    {
+        // scan inside each 128-bit half, then add the low half's total
+        // to the high half
+        x = add(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 4)));
+        x = add(x, _mm256_castsi256_ps(_mm256_slli_si256(_mm256_castps_si256(x), 8)));
+        Vec low = _mm256_permute_ps(x, 0xFF);
+        return add(x, _mm256_permute2f128_ps(low, low, 0x08));
+    }
+    SCAN_AVX2 static Vec last(Vec x)
+    {
+        return _mm256_permutevar8x32_ps(x, _mm256_set1_epi32(7));
+    }
+};
+
+template<> struct Avx2Ops<int32_t> {
+    typedef __m256i Vec;
+    static const size_t lanes = 8;
+    SCAN_AVX2 static Vec loadu(const int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    SCAN_AVX2 static void storeu(int32_t* p, Vec x) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x); }
+    SCAN_AVX2 static Vec add(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+    SCAN_AVX2 static Vec set1(int32_t v) { return _mm256_set1_epi32(v); }
+    SCAN_AVX2 static Vec shift1(Vec x)
+    {
+        Vec moved = _mm256_permutevar8x32_epi32(x, _mm256_setr_epi32(0, 0, 1, 2, 3, 4, 5, 6));
+        return _mm256_blend_epi32(moved, _mm256_setzero_si256(), 0x01);
+    }
+    SCAN_AVX2 static Vec prefix(Vec x)
+    {
+        x = add(x, _mm256_slli_si256(x, 4));
+        x = add(x, _mm256_slli_si256(x, 8));
+        Vec low = _mm256_shuffle_epi32(x, 0xFF);
+        return add(x, _mm256_permute2x128_si256(low, low, 0x08));
+    }
+    SCAN_AVX2 static Vec last(Vec x)
+    {
+        return _mm256_permutevar8x32_epi32(x, _mm256_set1_epi32(7));
+    }
+};
+
+// AVX-512: every shift is one masked cross-lane permute
+template<> struct Avx512Ops<double> {
+    typedef __m512d Vec;
+    static const size_t lanes = 8;
+    SCAN_AVX512 static Vec loadu(const double* p) { return _mm512_loadu_pd(p); }
+    SCAN_AVX512 static void storeu(double* p, Vec x) { _mm512_storeu_pd(p, x); }
+    SCAN_AVX512 static Vec add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+    SCAN_AVX512 static Vec set1(double v) { return _mm512_set1_pd(v); }
+    SCAN_AVX512 static Vec shift(Vec x, int k)
+    {
+        __m512i index = _mm512_sub_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7), _mm512_set1_epi64(k));
+        return _mm512_maskz_permutexvar_pd(static_cast<__mmask8>(0xFF << k), index, x);
+    }
+    SCAN_AVX512 static Vec shift1(Vec x) { return shift(x, 1); }
+    SCAN_AVX512 static Vec prefix(Vec x)
+    {
+        x = add(x, shift(x, 1));
+        x = add(x, shift(x, 2));
+        return add(x, shift(x, 4));
+    }
+    SCAN_AVX512 static Vec last(Vec x) { return _mm512_maskz_permutexvar_pd(0xFF, _mm512_set1_epi64(7), x); }
+};
+
+template<> struct Avx512Ops<int64_t> {
+    typedef __m512i Vec;
+    static const size_t lanes = 8;
+    SCAN_AVX512 static Vec loadu(const int64_t* p) { return _mm512_loadu_si512(p); }
+    SCAN_AVX512 static void storeu(int64_t* p, Vec x) { _mm512_storeu_si512(p, x); }
+    SCAN_AVX512 static Vec add(Vec a, Vec b) { return _mm512_add_epi64(a, b); }
+    SCAN_AVX512 static Vec set1(int64_t v) { return _mm512_set1_epi64(v); }
+    SCAN_AVX512 static Vec shift(Vec x, int k)
+    {
+        __m512i index = _mm512_sub_epi64(_mm512_setr_epi64(0, 1, 2, 3, 4, 5, 6, 7), _mm512_set1_epi64(k));
+        return _mm512_maskz_permutexvar_epi64(static_cast<__mmask8>(0xFF << k), index, x);
+    }
+    SCAN_AVX512 static Vec shift1(Vec x) { return shift(x, 1); }
+    SCAN_AVX512 static Vec prefix(Vec x)
+    {
+        x = add(x, shift(x, 1));
+        x = add(x, shift(x, 2));
+        return add(x, shift(x, 4));
+    }
+    SCAN_AVX512 static Vec last(Vec x) { return _mm512_maskz_permutexvar_epi64(0xFF, _mm512_set1_epi64(7), x); }
+};
+
+template<> struct Avx512Ops<float> {
+    typedef __m512 Vec;
+    static const size_t lanes = 16;
+    SCAN_AVX512 static Vec loadu(const float* p) { return _mm512_loadu_ps(p); }
+    SCAN_AVX512 static void storeu(float* p, Vec x) { _mm512_storeu_ps(p, x); }
+    SCAN_AVX512 static Vec add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+    SCAN_AVX512 static Vec set1(float v) { return _mm512_set1_ps(v); }
+    SCAN_AVX512 static Vec shift(Vec x, int k)
+    {
+        __m512i index = _mm512_sub_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                           8, 9, 10, 11, 12, 13, 14, 15),
+                                         _mm512_set1_epi32(k));
+        return _mm512_maskz_permutexvar_ps(static_cast<__mmask16>(0xFFFF << k), index, x);
+    }
+    SCAN_AVX512 static Vec shift1(Vec x) { return shift(x, 1); }
+    SCAN_AVX512 static Vec prefix(Vec x)
+    {
+        x = add(x, shift(x, 1));
+        x = add(x, shift(x, 2));
+        x = add(x, shift(x, 4));
+        return add(x, shift(x, 8));
+    }
+    SCAN_AVX512 static Vec last(Vec x) { return _mm512_maskz_permutexvar_ps(0xFFFF, _mm512_set1_epi32(15), x); }
+};
+
+template<> struct Avx512Ops<int32_t> {
+    typedef __m512i Vec;
+    static const size_t lanes = 16;
+    SCAN_AVX512 static Vec loadu(const int32_t* p) { return _mm512_loadu_si512(p); }
+    SCAN_AVX512 static void storeu(int32_t* p, Vec x) { _mm512_storeu_si512(p, x); }
+    SCAN_AVX512 static Vec add(Vec a, Vec b) { return _mm512_add_epi32(a, b); }
+    SCAN_AVX512 static Vec set1(int32_t v) { return _mm512_set1_epi32(v); }
+    SCAN_AVX512 static Vec shift(Vec x, int k)
+    {
+        __m512i index = _mm512_sub_epi32(_mm512_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7,
+                                                           8, 9, 10, 11, 12, 13, 14, 15),
+                                         _mm512_set1_epi32(k));
+        return _mm512_maskz_permutexvar_epi32(static_cast<__mmask16>(0xFFFF << k), index, x);
+    }
+    SCAN_AVX512 static Vec shift1(Vec x) { return shift(x, 1); }
+    SCAN_AVX512 static Vec prefix(Vec x)
+    {
+        x = add(x, shift(x, 1));
+        x = add(x, shift(x, 2));
+        x = add(x, shift(x, 4));
+        return add(x, shift(x, 8));
+    }
+    SCAN_AVX512 static Vec last(Vec x) { return _mm512_maskz_permutexvar_epi32(0xFFFF, _mm512_set1_epi32(15), x); }
+};
+
+// The kernels are the same for every ISA, but a function can only be
+// compiled for one target, so they are stamped out once per ISA.
+#define SCAN_DEFINE_KERNELS(Ops, TARGET)                                      \
+template<class T>                                                             \
+TARGET T inclusiveScan##Ops(const T* in, T* out, size_t n, T carry)           \
+{                                                                             \
+    typedef Ops<T> V;                                                         \
+    typename V::Vec c = V::set1(carry);                                       \
+    size_t i = 0;                                                             \
+    for(; i + V::lanes <= n; i += V::lanes)                                   \
+    {                                                                         \
+        typename V::Vec x = V::add(V::prefix(V::loadu(in + i)), c);           \
+        V::storeu(out + i, x);                                                \
+        c = V::last(x);                                                       \
+    }                                                                         \
+    T tail[V::lanes];                                                         \
+    V::storeu(tail, c);                                                       \
+    return scalarInclusiveScan(in + i, out + i, n - i, tail[0]);              \
+}                                                                             \
+                                                                              \
+template<class T>                                                             \
+TARGET T exclusiveScan##Ops(const T* in, T* out, size_t n, T carry)           \
+{                                                                             \
+    typedef Ops<T> V;                                                         \
+    typename V::Vec c = V::set1(carry);                                       \
+    size_t i = 0;                                                             \
+    for(; i + V::lanes <= n; i += V::lanes)                                   \
+    {                                                                         \
+        typename V::Vec x = V::prefix(V::loadu(in + i));                      \
+        V::storeu(out + i, V::add(V::shift1(x), c));                          \
+        c = V::add(V::last(x), c);                                            \
+    }                                                                         \
+    T tail[V::lanes];                                                         \
+    V::storeu(tail, c);                                                       \
+    return scalarExclusiveScan(in + i, out + i, n - i, tail[0]);              \
+}                                                                             \
+                                                                              \
+template<class T>                                                             \
+TARGET T reduce##Ops(const T* in, size_t n)                                   \
+{                                                                             \
+    typedef Ops<T> V;                                                         \
+    /* four independent accumulators hide the add latency */                 \
+    typename V::Vec a0 = V::set1(T()), a1 = a0, a2 = a0, a3 = a0;             \
+    size_t i = 0;                                                             \
+    for(; i + 4*V::lanes <= n; i += 4*V::lanes)                               \
+    {                                                                         \
+        a0 = V::add(a0, V::loadu(in + i));                                    \
+        a1 = V::add(a1, V::loadu(in + i + V::lanes));                         \
+        a2 = V::add(a2, V::loadu(in + i + 2*V::lanes));                       \
+        a3 = V::add(a3, V::loadu(in + i + 3*V::lanes));                       \
+    }                                                                         \
+    T lanes[V::lanes];                                                        \
+    V::storeu(lanes, V::add(V::add(a0, a1), V::add(a2, a3)));                 \
+    T acc = scalarReduce(in + i, n - i);                                      \
+    for(size_t l = 0; l < V::lanes; ++l)                                      \
+        acc += lanes[l];                                                      \
+    return acc;                                                               \
+}
+
+SCAN_DEFINE_KERNELS(Sse2Ops, SCAN_SSE2)
+SCAN_DEFINE_KERNELS(Avx2Ops, SCAN_AVX2)
+SCAN_DEFINE_KERNELS(Avx512Ops, SCAN_AVX512)
+
+#undef SCAN_DEFINE_KERNELS
+
+#endif
+
+// out[i] = carry + in[0] + ... + in[i], returns the carry for what follows
+template<class T>
+T simdInclusiveScan(const T* in, T* out, size_t n, T carry)
+{
+#ifdef SCAN_KERNELS_X86
+    switch(simdLevel()) {
+    case SimdLevel::AVX512: return inclusiveScanAvx512Ops(in, out, n, carry);
+    case SimdLevel::AVX2: return inclusiveScanAvx2Ops(in, out, n, carry);
+    case SimdLevel::SSE2: return inclusiveScanSse2Ops(in, out, n, carry);
+    default: break;
+    }
+#endif
+    return scalarInclusiveScan(in, out, n, carry);
+}
+
+// out[i] = carry + in[0] + ... + in[i-1], returns the carry for what follows
+template<class T>
+T simdExclusiveScan(const T* in, T* out, size_t n, T carry)
+{
+#ifdef SCAN_KERNELS_X86
+    switch(simdLevel()) {
+    case SimdLevel::AVX512: return exclusiveScanAvx512Ops(in, out, n, carry);
+    case SimdLevel::AVX2: return exclusiveScanAvx2Ops(in, out, n, carry);
+    case SimdLevel::SSE2: return exclusiveScanSse2Ops(in, out, n, carry);
+    default: break;
+    }
+#endif
+    return scalarExclusiveScan(in, out, n, carry);
+}
+
+template<class T>
+T simdReduce(const T* in, size_t n)
+{
+#ifdef SCAN_KERNELS_X86
+    switch(simdLevel()) {
+    case SimdLevel::AVX512: return reduceAvx512Ops(in, n);
+    case SimdLevel::AVX2: return reduceAvx2Ops(in, n);
+    case SimdLevel::SSE2: return reduceSse2Ops(in, n);
+    default: break;
+    }
+#endif
+    return scalarReduce(in, n);
+}
+
+#endif
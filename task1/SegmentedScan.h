@@ -0,0 +1,179 @@
+#ifndef SEGMENTED_SCAN_H
+#define SEGMENTED_SCAN_H
+
+#include <vector>
+#include <functional>
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+
+#include "ThreadPool.h"
+#include "Scan.h"
+
+// Segmented scan: many independent scans over one flat buffer in a single
+// parallel pass. Segments are given either as head flags (flags[i] != 0
+// starts a new segment) or as offsets (segment s is [offsets[s],
+// offsets[s+1])); element 0 always starts a segment. Lengths are arbitrary.
+// The pass is the reduce-then-scan of Scan.h with the segmented operator:
+// a block's summary is "did a segment start here" plus the total since its
+// last head, and a carry only flows into a block up to its first head.
+
+struct FlagHeads {
+    const uint8_t* flags;
+
+    struct Cursor {
+        const uint8_t* flags;
+        bool isHead(size_t i) { return i == 0 || flags[i] != 0; }
+    };
+    Cursor cursor(size_t) const { return Cursor{flags}; }
+};
+
+struct OffsetHeads {
+    const size_t* offsets;
+    size_t segments;
+
+    // isHead is called with increasing i, so we just walk the offsets
+    struct Cursor {
+        const size_t* next;
+        const size_t* end;
+        bool isHead(size_t i)
+        {
+            bool head = i == 0;
+            while(next != end && *next <= i)
+                head |= *next++ == i;
+            return head;
+        }
+    };
+    Cursor cursor(size_t start) const
+    {
+        const size_t* end = offsets + segments + 1;
+        return Cursor{std::lower_bound(offsets, end, start), end};
+    }
+};
+
+template<class T>
+struct SegmentSummary {
+    bool hasHead;
+    T value;
+};
+
+template<class T, class Op, class Cursor>
+SegmentSummary<T> segmentedReduce(const T* first, const T* last, size_t base, Cursor cursor, Op op)
+{
+    SegmentSummary<T> summary = { cursor.isHead(base), *first };
+    for(size_t i = 1; first + i != last; ++i)
+    {
+        if(cursor.isHead(base + i))
+        {
+            summary.hasHead = true;
+            summary.value = first[i];
+        }
+        else
+        {
+            summary.value = op(summary.value, first[i]);
+        }
+    }
+    return summary;
+}
+
+// carry is the inclusive total of the current segment up to base - 1, or
+// nullptr if base is the first element; init is the start value of every
+// segment for an exclusive scan, nullptr for an inclusive one
+template<class T, class Op, class Cursor>
+void segmentedBlockScan(const T* first, const T* last, T* out, size_t base, Cursor cursor,
+                        const T* carry, const T* init, Op op)
+{
+    T acc = carry ? *carry : T();
+    bool running = carry != nullptr;
+    if(init && running)
+        acc = op(*init, acc);
+    for(size_t i = 0; first + i != last; ++i)
+    {
+        T value = first[i];
+        bool head = cursor.isHead(base + i) || !running;
+        if(init)
+        {
+            if(head)
+                acc = *init;
+            out[i] = acc;
+            acc = op(acc, value);
+        }
+        else
+        {
+            acc = head ? value : op(acc, value);
+            out[i] = acc;
+        }
+        running = true;
+    }
+}
+
+template<class T, class Op, class Heads>
+void segmentedScan(ThreadPool& pool, const T* first, const T* last, Heads heads, T* out,
+                   const T* init, Op op)
+{
+    size_t size = last - first;
+    if(size == 0)
+        return;
+    if(size < scanSerialCutoff || pool.size() == 1)
+    {
+        segmentedBlockScan(first, last, out, 0, heads.cursor(0), static_cast<const T*>(nullptr), init, op);
+        return;
+    }
+
+    size_t blocks = std::min(pool.size(), size);
+    std::vector< SegmentSummary<T> > summary(blocks);
+    forEachBlock(pool, first, size, blocks, [&](size_t b)
+    {
+        size_t begin = size*b/blocks;
+        summary[b] = segmentedReduce(first + begin, first + size*(b+1)/blocks, begin,
+                                     heads.cursor(begin), op);
+    });
+
+    // carry[b]: total of the segment running into block b, before it starts;
+    // block 0 always has a head, so carry[0] is never read
+    std::vector<T> carry(blocks);
+    for(size_t b = 1; b < blocks; ++b)
+        carry[b] = summary[b-1].hasHead
+                   ? summary[b-1].value
+                   : op(carry[b-1], summary[b-1].value);
+
+    forEachBlock(pool, first, size, blocks, [&](size_t b)
+    {
+        size_t begin = size*b/blocks;
+        segmentedBlockScan(first + begin, first + size*(b+1)/blocks, out + begin, begin,
+                           heads.cursor(begin), b == 0 ? nullptr : &carry[b], init, op);
+    });
+}
+
+template<class T, class Op = std::plus<T> >
+void segmentedInclusiveScan(ThreadPool& pool, const T* first, const T* last,
+                            const uint8_t* flags, T* out, Op op = Op())
+{
+    segmentedScan(pool, first, last, FlagHeads{flags}, out, static_cast<const T*>(nullptr), op);
+}
+
+// every segment starts from init
+template<class T, class Op = std::plus<T> >
+void segmentedExclusiveScan(ThreadPool& pool, const T* first, const T* last,
+                            const uint8_t* flags, T* out, T init, Op op = Op())
+{
+    segmentedScan(pool, first, last, FlagHeads{flags}, out, &init, op);
+}
+
+// offsets holds segments + 1 entries, offsets[segments] == last - first
+template<class T, class Op = std::plus<T> >
+void segmentedInclusiveScan(ThreadPool& pool, const T* first, const T* last,
+                            const size_t* offsets, size_t segments, T* out, Op op = Op())
+{
+    segmentedScan(pool, first, last, OffsetHeads{offsets, segments}, out,
+                  static_cast<const T*>(nullptr), op);
+}
+
+template<class T, class Op = std::plus<T> >
+void segmentedExclusiveScan(ThreadPool& pool, const T* first, const T* last,
+                            const size_t* offsets, size_t segments, T* out, T init, Op op = Op())
+{
+    segmentedScan(pool, first, last, OffsetHeads{offsets, segments}, out, &init, op);
+}
+
+#endif
@@ -0,0 +1,160 @@
+#ifndef STREAM_SCAN_H
+#define STREAM_SCAN_H
+
+#include <string>
+#include <cstring>
+#include <cerrno>
+#include <stdexcept>
+#include <functional>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ThreadPool.h"
+#include "Scan.h"
+
+// Out-of-core inclusive prefix sum of a raw native-endian binary column of
+// T. The input is mapped one window at a time and each window is scanned in
+// parallel into a separate shared mapping of the output file, carrying the
+// running total across window boundaries. While a window is being scanned
+// the next one is already mapped and madvise(MADV_WILLNEED)'d, so kernel
+// readahead overlaps the I/O with the compute. At most two input windows
+// and one output window are mapped at any time: peak RSS is about three
+// windows however large the file is.
+
+// default window size, large enough to amortize mmap and thread wake-ups
+const size_t streamScanWindowBytes = size_t(64) << 20;
+
+class MappedWindow {
+public:
+    MappedWindow() : address(nullptr), length(0) {}
+    // sequential: the window is read front to back soon, so ask for
+    // readahead; leave it off for mappings read in no particular order
+    MappedWindow(int fd, size_t offset, size_t length, bool writable, bool sequential = true)
+        : address(nullptr), length(length)
+    {
+        if(length == 0)
+            return;
+        int protection = writable ? PROT_READ | PROT_WRITE : PROT_READ;
+        address = mmap(nullptr, length, protection, MAP_SHARED, fd, static_cast<off_t>(offset));
+        if(address == MAP_FAILED)
+            throw std::runtime_error(std::string("mmap failed: ") + std::strerror(errno));
+        if(!sequential)
+            return;
+        madvise(address, length, MADV_SEQUENTIAL);
+        // start readahead now, the window is needed only after the current one
+        if(!writable)
+            madvise(address, length, MADV_WILLNEED);
+    }
+    ~MappedWindow() { reset(); }
+
+    MappedWindow(MappedWindow&& other) : address(other.address), length(other.length)
+    {
+        other.address = nullptr;
+    }
+    MappedWindow& operator=(MappedWindow&& other)
+    {
+        if(this != &other)
+        {
+            reset();
+            address = other.address;
+            length = other.length;
+            other.address = nullptr;
+        }
+        return *this;
+    }
+    MappedWindow(const MappedWindow&) = delete;
+    MappedWindow& operator=(const MappedWindow&) = delete;
+
+    void reset()
+    {
+        if(address)
+            munmap(address, length);
+        address = nullptr;
+    }
+
+    template<class T>
+    T* as() const { return static_cast<T*>(address); }
+private:
+    void* address;
+    size_t length;
+};
+
+class FileHandle {
+public:
+    FileHandle(const std::string& path, int flags, mode_t mode = 0644)
+        : fd(open(path.c_str(), flags, mode))
+    {
+        if(fd < 0)
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+    }
+    ~FileHandle() { close(fd); }
+    FileHandle(const FileHandle&) = delete;
+    FileHandle& operator=(const FileHandle&) = delete;
+
+    int get() const { return fd; }
+private:
+    int fd;
+};
+
+// scans inPath into outPath (created or truncated), returns the total;
+// the two have to be different files
+template<class T, class Op = std::plus<T> >
+T streamInclusiveScan(ThreadPool& pool, const std::string& inPath, const std::string& outPath,
+                      size_t windowBytes = streamScanWindowBytes, Op op = Op())
+{
+    FileHandle in(inPath, O_RDONLY);
+    struct stat info;
+    if(fstat(in.get(), &info) != 0)
+        throw std::runtime_error("cannot stat " + inPath + ": " + std::strerror(errno));
+    size_t bytes = static_cast<size_t>(info.st_size);
+    if(bytes % sizeof(T) != 0)
+        throw std::runtime_error(inPath + " is not a whole number of elements");
+    size_t count = bytes / sizeof(T);
+
+    // not truncated on open: if it is the input, that would wipe it
+    FileHandle out(outPath, O_RDWR | O_CREAT);
+    struct stat outInfo;
+    if(fstat(out.get(), &outInfo) != 0)
+        throw std::runtime_error("cannot stat " + outPath + ": " + std::strerror(errno));
+    if(outInfo.st_dev == info.st_dev && outInfo.st_ino == info.st_ino)
+        throw std::invalid_argument(outPath + " is the input file " + inPath);
+    if(ftruncate(out.get(), static_cast<off_t>(bytes)) != 0)
+        throw std::runtime_error("cannot resize " + outPath + ": " + std::strerror(errno));
+    if(count == 0)
+        return T();
+
+    // windows start on page boundaries and on element boundaries
+    size_t page = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t unit = page;
+    while(unit % sizeof(T) != 0)
+        unit += page;
+    size_t window = std::max(unit, windowBytes / unit * unit);
+
+    MappedWindow current(in.get(), 0, std::min(window, bytes), false);
+    T carry = T();
+    for(size_t offset = 0; offset < bytes; offset += window)
+    {
+        size_t length = std::min(window, bytes - offset);
+        size_t next = offset + window;
+        MappedWindow ahead;
+        if(next < bytes)
+            ahead = MappedWindow(in.get(), next, std::min(window, bytes - next), false);
+
+        MappedWindow target(out.get(), offset, length, true);
+        const T* first = current.as<const T>();
+        const T* last = first + length / sizeof(T);
+        if(offset == 0)
+            inclusiveScan(pool, first, last, target.as<T>(), op);
+        else
+            inclusiveScan(pool, first, last, target.as<T>(), carry, op);
+        carry = target.as<T>()[length / sizeof(T) - 1];
+
+        current = std::move(ahead);
+    }
+    return carry;
+}
+
+#endif
@@ -0,0 +1,185 @@
+#ifndef TASK_GRAPH_H
+#define TASK_GRAPH_H
+
+#include <vector>
+#include <memory>
+#include <atomic>
+#include <mutex>
+#include <functional>
+#include <exception>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+
+// Dataflow graph on top of ThreadPool. Nodes declare their predecessors
+// (precede / succeed) or hang a continuation off an existing node (then);
+// run() starts every node as soon as all of its inputs have finished, so
+// there is no global barrier between "levels" of work.
+class TaskGraph {
+    struct NodeData;
+public:
+    class Node {
+    public:
+        Node() : data(nullptr) {}
+
+        // this node runs before / after other
+        Node& precede(Node other);
+        Node& succeed(Node other);
+        // new node that runs once this one has finished
+        template<class F>
+        Node then(F&& fn);
+    private:
+        friend class TaskGraph;
+        Node(TaskGraph* graph, NodeData* data) : graph(graph), data(data) {}
+
+        TaskGraph* graph;
+        NodeData* data;
+    };
+
+    explicit TaskGraph(ThreadPool& pool) : pool(pool), failed(false) {}
+    TaskGraph(const TaskGraph&) = delete;
+    TaskGraph& operator=(const TaskGraph&) = delete;
+
+    template<class F>
+    Node emplace(F&& fn);
+
+    // executes the whole graph and blocks until every node has finished;
+    // the first exception thrown by a node is rethrown here and the nodes
+    // that had not started yet are skipped. A graph can be run repeatedly.
+    void run();
+
+    size_t size() const { return nodes.size(); }
+private:
+    struct NodeData {
+        std::function<void()> fn;
+        std::vector<NodeData*> successors;
+        size_t predecessors;
+        std::atomic<size_t> waiting;
+
+        template<class F>
+        explicit NodeData(F&& fn)
+            : fn(std::forward<F>(fn)), predecessors(0), waiting(0) {}
+    };
+
+    void schedule(NodeData* node);
+    void execute(NodeData* node);
+    void check_acyclic();
+
+    ThreadPool& pool;
+    std::vector< std::unique_ptr<NodeData> > nodes;
+
+    // state of the current run
+    std::unique_ptr<Latch> done;
+    std::atomic<bool> failed;
+    std::exception_ptr error;
+    std::mutex error_mutex;
+};
+
+inline TaskGraph::Node& TaskGraph::Node::precede(Node other)
+{
+    data->successors.push_back(other.data);
+    ++other.data->predecessors;
+    return *this;
+}
+
+inline TaskGraph::Node& TaskGraph::Node::succeed(Node other)
+{
+    other.precede(*this);
+    return *this;
+}
+
+template<class F>
+TaskGraph::Node TaskGraph::Node::then(F&& fn)
+{
+    Node next = graph->emplace(std::forward<F>(fn));
+    precede(next);
+    return next;
+}
+
+template<class F>
+TaskGraph::Node TaskGraph::emplace(F&& fn)
+{
+    nodes.emplace_back(new NodeData(std::forward<F>(fn)));
+    return Node(this, nodes.back().get());
+}
+
+// Kahn's algorithm on the waiting counters: every node has to become
+// ready at some point, otherwise run() would never finish
+inline void TaskGraph::check_acyclic()
+{
+    std::vector<NodeData*> ready;
+    for(auto& node: nodes) {
+        node->waiting.store(node->predecessors);
+        if(node->predecessors == 0)
+            ready.push_back(node.get());
+    }
+
+    size_t visited = 0;
+    while(!ready.empty()) {
+        NodeData* node = ready.back();
+        ready.pop_back();
+        ++visited;
+        for(NodeData* next: node->successors)
+            if(--next->waiting == 0)
+                ready.push_back(next);
+    }
+    if(visited != nodes.size())
+        throw std::logic_error("TaskGraph contains a cycle");
+}
+
+inline void TaskGraph::schedule(NodeData* node)
+{
+    pool.post([this, node] { execute(node); });
+}
+
+inline void TaskGraph::execute(NodeData* node)
+{
+    // keep running one ready successor on this thread instead of going
+    // through the pool, the rest are handed out to other workers
+    while(node) {
+        if(!failed.load(std::memory_order_relaxed)) {
+            try {
+                node->fn();
+            } catch(...) {
+                std::unique_lock<std::mutex> lock(error_mutex);
+                if(!error)
+                    error = std::current_exception();
+                failed.store(true);
+            }
+        }
+
+        NodeData* next = nullptr;
+        for(NodeData* successor: node->successors) {
+            if(successor->waiting.fetch_sub(1) != 1)
+                continue;
+            if(next)
+                schedule(next);
+            next = successor;
+        }
+        node = next;
+        done->count_down();
+    }
+}
+
+inline void TaskGraph::run()
+{
+    if(nodes.empty())
+        return;
+
+    check_acyclic();
+    for(auto& node: nodes)
+        node->waiting.store(node->predecessors);
+
+    error = nullptr;
+    failed.store(false);
+    done.reset(new Latch(nodes.size()));
+    for(auto& node: nodes)
+        if(node->predecessors == 0)
+            schedule(node.get());
+    pool.wait(*done);
+
+    if(error)
+        std::rethrow_exception(error);
+}
+
+#endif
@@ -2,65 +2,706 @@
 #define THREAD_POOL_H
 
 #include <vector>
-#include <queue>
+#include <deque>
 #include <memory>
 #include <thread>
 #include <mutex>
+#include <atomic>
 #include <condition_variable>
 #include <future>
 #include <functional>
 #include <stdexcept>
+#include <exception>
+#include <algorithm>
+#include <cstdint>
+#include <chrono>
+#include <string>
+#include <sstream>
+#include <fstream>
 
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#endif
+
+#include "WorkStealingDeque.h"
+
+// One-shot countdown, a single wait for a whole batch of tasks instead of
+// one future per task.
+class Latch {
+public:
+    explicit Latch(size_t count) : count(count) {}
+
+    void count_down()
+    {
+        // notify under the lock, the waiter may destroy us right after
+        std::unique_lock<std::mutex> lock(mutex);
+        if(--count == 0)
+            condition.notify_all();
+    }
+
+    void wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        condition.wait(lock, [this]{ return count == 0; });
+    }
+
+    bool try_wait()
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return count == 0;
+    }
+
+    template<class Rep, class Period>
+    bool wait_for(const std::chrono::duration<Rep, Period>& timeout)
+    {
+        std::unique_lock<std::mutex> lock(mutex);
+        return condition.wait_for(lock, timeout, [this]{ return count == 0; });
+    }
+private:
+    size_t count;
+    std::mutex mutex;
+    std::condition_variable condition;
+};
+
+// Work-stealing thread pool. Every worker owns a Chase-Lev deque: tasks
+// enqueued from inside a task go to the caller's deque (LIFO for locality),
+// tasks enqueued from outside the pool are spread round-robin over small
+// per-worker inboxes. Idle workers steal from a random victim.
 class ThreadPool {
 public:
+    // how parallel_for and friends cut [begin, end) into chunks:
+    // Static  - one contiguous block per worker, no shared counter
+    // Dynamic - fixed-size chunks handed out through an atomic counter
+    // Guided  - chunks shrink with the remaining work, never below grain
+    enum class Partition { Static, Dynamic, Guided };
+
+    // where workers may run:
+    // None      - wherever the OS schedules them
+    // Cores     - worker i pinned to one core, NUMA node by node
+    // NumaNodes - workers spread evenly over the NUMA nodes, each free to
+    //             move between the cores of its node
+    enum class Affinity { None, Cores, NumaNodes };
+
+    struct Options {
+        size_t threads;
+        Affinity affinity;
+        // an idle worker polls the queues spin times, then yields yield
+        // times, and only then parks on the condition variable
+        unsigned spin;
+        unsigned yield;
+
+        Options(size_t threads = std::thread::hardware_concurrency())
+            : threads(threads), affinity(Affinity::None), spin(0), yield(0) {}
+    };
+
     ThreadPool(size_t);
+    explicit ThreadPool(const Options&);
     template<class F, class... Args>
-    auto enqueue(F&& f, Args&&... args) 
+    auto enqueue(F&& f, Args&&... args)
         -> std::future<typename std::result_of<F(Args...)>::type>;
+    // fire and forget, no future is created; f must not throw
+    template<class F>
+    void post(F&& f);
+    // like post, but only workers placed on that NUMA node will run it;
+    // anyone may if no worker is placed there
+    template<class F>
+    void post_on_node(int node, F&& f);
+
+    // fn(chunkBegin, chunkEnd) for every chunk of [begin, end); grain is
+    // the smallest chunk worth scheduling, 0 picks one from the pool size.
+    // The calling thread takes part and returns once every chunk is done.
+    // With affinity set, Static chunk r runs on worker r when the call
+    // comes from outside the pool and the range is split over more than
+    // one runner, so such loops revisit data from the worker that first
+    // touched it. Called from a worker, chunk 0 runs on the caller, and a
+    // range left in one chunk runs wholly on the caller.
+    template<class Index, class F>
+    void parallel_range(Index begin, Index end, Index grain, F&& fn,
+                        Partition partition = Partition::Dynamic);
+    // fn(i) for every i in [begin, end)
+    template<class Index, class F>
+    void parallel_for(Index begin, Index end, Index grain, F&& fn,
+                      Partition partition = Partition::Dynamic);
+    // combine(...combine(identity, map(b0, e0))..., map(bk, ek)); partial
+    // results are merged in worker order, so only Static partitioning gives
+    // the same floating point rounding on every run
+    template<class Index, class T, class Map, class Combine>
+    T parallel_reduce(Index begin, Index end, Index grain, T identity,
+                      Map&& map, Combine&& combine,
+                      Partition partition = Partition::Dynamic);
+
+    // Helping waits: block until the future / latch is ready, running queued
+    // tasks (own deque first, then stolen ones) in the meantime. A worker
+    // waiting on a child task therefore never sits idle, and nested
+    // fork-join on a fixed number of threads cannot deadlock.
+    template<class T>
+    void wait(const std::future<T>& future);
+    void wait(Latch& latch);
+
+    // Opt-in runtime statistics. While disabled the only cost is one relaxed
+    // load per task; enabled, every task pays two clock reads and a look
+    // at the size of every queue, for peak_pending.
+    static const size_t latency_buckets = 40;
+    struct WorkerStats {
+        uint64_t tasks;        // tasks executed
+        uint64_t steals;       // of those, taken from another worker's queues
+        uint64_t idle;         // times parked on the condition
+        uint64_t idle_ns;      // time spent parked
+        uint64_t busy_ns;      // time spent inside tasks
+        // enqueue-to-start latency, bucket i counts [2^i, 2^(i+1)) ns
+        std::vector<uint64_t> latency;
+    };
+    struct Stats {
+        std::vector<WorkerStats> workers;
+        // threads outside the pool that ran tasks while waiting
+        WorkerStats external;
+        size_t pending;
+        size_t peak_pending;
+
+        WorkerStats total() const;
+        std::string to_json() const;
+    };
+    void enable_stats(bool enabled = true);
+    void reset_stats();
+    Stats stats() const;
+
+    size_t size() const { return workers.size(); }
+    // true on one of this pool's own worker threads
+    bool is_worker() const { return current_pool() == this; }
+    // NUMA node worker i was placed on, 0 without affinity
+    int node_of_worker(size_t worker) const { return worker_node[worker]; }
+    // true if the workers are placed on more than one NUMA node
+    bool spans_nodes() const;
+    // NUMA node holding the page of address, -1 if unknown or not touched
+    static int node_of(const void* address);
     ~ThreadPool();
 private:
+    struct Task {
+        std::function<void()> fn;
+        // steady clock in ns, only stamped while stats are enabled
+        int64_t enqueued;
+        // queued for one worker only
+        bool pinned;
+
+        template<class F>
+        explicit Task(F&& fn)
+            : fn(std::forward<F>(fn)), enqueued(0), pinned(false) {}
+    };
+
+    struct Counters {
+        std::atomic<uint64_t> tasks;
+        std::atomic<uint64_t> steals;
+        std::atomic<uint64_t> idle;
+        std::atomic<uint64_t> idle_ns;
+        std::atomic<uint64_t> busy_ns;
+        std::atomic<uint64_t> latency[latency_buckets];
+
+        Counters() { reset(); }
+        void reset();
+        void add(std::atomic<uint64_t>& counter, uint64_t value)
+        {
+            counter.fetch_add(value, std::memory_order_relaxed);
+        }
+        WorkerStats snapshot() const;
+    };
+
+    // hands out chunks of [0, size) to the runners of one parallel call
+    struct Splitter {
+        Partition partition;
+        size_t size;
+        size_t grain;
+        size_t runners;
+        std::atomic<size_t> next;
+
+        Splitter(Partition partition, size_t size, size_t grain, size_t threads);
+        bool claim(size_t runner, size_t& round, size_t& first, size_t& last);
+    };
+
+    struct Worker {
+        // only the owning thread pushes and pops, thieves take the top
+        WorkStealingDeque<Task*> local;
+        // tasks submitted by threads outside the pool; pinned ones may only
+        // be run by this worker
+        std::deque<Task*> inbox;
+        std::deque<Task*> pinned;
+        std::mutex inbox_mutex;
+        // sizes of inbox and pinned, written under inbox_mutex
+        std::atomic<size_t> inbox_size;
+        std::atomic<size_t> pinned_size;
+        Counters counters;
+
+        Worker() : inbox_size(0), pinned_size(0) {}
+    };
+
+    void submit(Task* task);
+    void submit_to(size_t worker, Task* task);
+    void wake(bool all);
+    // anything worker self could run; self == queues.size() for outsiders
+    bool has_work(size_t self) const;
+    // tasks queued anywhere, a racy snapshot
+    size_t queued() const;
+    template<class Runner>
+    void fork_join(size_t runners, Runner& runner, bool directed);
+    Task* find_task(size_t self, bool& stolen);
+    void run_task(Task* task, size_t self, bool stolen);
+    Counters& counters_of(size_t self);
+    static int64_t now_ns();
+    template<class Done, class Block>
+    void help_until(Done done, Block block);
+    Task* pop_inbox(Worker& worker, bool owner);
+    bool directed(Partition partition) const
+    {
+        return partition == Partition::Static && options.affinity != Affinity::None;
+    }
+    void run(size_t index);
+    void place_worker(size_t index);
+    static void cpu_relax();
+    // every NUMA node with cpus, as its id and its cpus; a single node 0
+    // with all cpus if unknown
+    static std::vector< std::pair<int, std::vector<int> > > numa_topology();
+    static std::vector<int> parse_cpu_list(const std::string& list);
+
+    // which pool (if any) the calling thread works for, and its slot
+    static ThreadPool*& current_pool();
+    static size_t& current_index();
+    static uint32_t next_random();
+
+    Options options;
+    std::vector<int> worker_node;
+    std::vector< std::vector<int> > worker_cpus;
+
     // need to keep track of threads so we can join them
     std::vector< std::thread > workers;
-    // the task queue
-    std::queue< std::function<void()> > tasks;
-    
-    // synchronization
-    std::mutex queue_mutex;
+    std::vector< std::unique_ptr<Worker> > queues;
+
+    std::atomic<size_t> next_inbox;
+
+    // Synchronization for idle workers. Nothing shared is written per task:
+    // a parking worker counts itself in sleeping and then looks at every
+    // queue once more, a submitter queues its task and then reads
+    // sleeping, with a seq_cst fence in between on both sides. So either
+    // the worker finds the task or the submitter sees it parked and bumps
+    // wakeups, which is only touched while someone sleeps.
+    std::atomic<size_t> sleeping;
+    std::mutex sleep_mutex;
+    size_t wakeups;
     std::condition_variable condition;
-    bool stop;
+    std::atomic<bool> stop;
+
+    std::atomic<bool> stats_enabled;
+    std::atomic<size_t> peak_pending;
+    Counters external;
 };
- 
-// the constructor just launches some amount of workers
+
 inline ThreadPool::ThreadPool(size_t threads)
-    :   stop(false)
+    :   ThreadPool(Options(threads))
 {
-    for(size_t i = 0;i<threads;++i)
-        workers.emplace_back(
-            [this]
-            {
-                for(;;)
-                {
-                    std::function<void()> task;
-
-                    {
-                        std::unique_lock<std::mutex> lock(this->queue_mutex);
-                        this->condition.wait(lock,
-                            [this]{ return this->stop || !this->tasks.empty(); });
-                        if(this->stop && this->tasks.empty())
-                            return;
-                        task = std::move(this->tasks.front());
-                        this->tasks.pop();
-                    }
-
-                    task();
-                }
+}
+
+// the constructor just launches some amount of workers
+inline ThreadPool::ThreadPool(const Options& opts)
+    :   options(opts), next_inbox(0), sleeping(0), wakeups(0), stop(false),
+        stats_enabled(false), peak_pending(0)
+{
+    size_t threads = std::max<size_t>(1, options.threads);
+    worker_node.assign(threads, 0);
+    worker_cpus.resize(threads);
+    if(options.affinity != Affinity::None)
+    {
+        std::vector< std::pair<int, std::vector<int> > > nodes = numa_topology();
+        std::vector<int> cores, core_node;
+        for(size_t node = 0; node < nodes.size(); ++node)
+            for(int cpu: nodes[node].second) {
+                cores.push_back(cpu);
+                core_node.push_back(nodes[node].first);
             }
-        );
+        for(size_t i = 0; i < threads; ++i)
+        {
+            if(options.affinity == Affinity::Cores && !cores.empty()) {
+                worker_cpus[i].push_back(cores[i % cores.size()]);
+                worker_node[i] = core_node[i % cores.size()];
+            } else if(options.affinity == Affinity::NumaNodes) {
+                size_t node = i * nodes.size() / threads;
+                worker_cpus[i] = nodes[node].second;
+                worker_node[i] = nodes[node].first;
+            }
+        }
+    }
+
+    for(size_t i = 0;i<threads;++i)
+        queues.emplace_back(new Worker());
+    for(size_t i = 0;i<threads;++i)
+        workers.emplace_back([this, i] { run(i); });
+}
+
+inline std::vector<int> ThreadPool::parse_cpu_list(const std::string& list)
+{
+    // "0-3,8,10-11"
+    std::vector<int> cpus;
+    std::istringstream in(list);
+    std::string range;
+    while(std::getline(in, range, ',')) {
+        if(range.empty() || range[0] < '0' || range[0] > '9')
+            continue;
+        size_t dash = range.find('-');
+        int first = std::stoi(range.substr(0, dash));
+        int last = dash == std::string::npos ? first : std::stoi(range.substr(dash + 1));
+        for(int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
+
+inline std::vector< std::pair<int, std::vector<int> > > ThreadPool::numa_topology()
+{
+    std::vector< std::pair<int, std::vector<int> > > nodes;
+#ifdef __linux__
+    // node ids may have gaps, and memory-only nodes have no cpus
+    std::ifstream online("/sys/devices/system/node/online");
+    std::string ids;
+    if(std::getline(online, ids))
+        for(int node: parse_cpu_list(ids)) {
+            std::ifstream file("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+            std::string list;
+            std::getline(file, list);
+            std::vector<int> cpus = parse_cpu_list(list);
+            if(!cpus.empty())
+                nodes.push_back(std::make_pair(node, cpus));
+        }
+#endif
+    if(nodes.empty()) {
+        std::vector<int> cpus;
+        for(unsigned cpu = 0; cpu < std::max(1u, std::thread::hardware_concurrency()); ++cpu)
+            cpus.push_back(static_cast<int>(cpu));
+        nodes.push_back(std::make_pair(0, cpus));
+    }
+    return nodes;
+}
+
+inline bool ThreadPool::spans_nodes() const
+{
+    return std::any_of(worker_node.begin(), worker_node.end(),
+                       [this](int node){ return node != worker_node[0]; });
+}
+
+inline int ThreadPool::node_of(const void* address)
+{
+#if defined(__linux__) && defined(SYS_move_pages)
+    // move_pages without target nodes only reports where the page lives
+    long page = sysconf(_SC_PAGESIZE);
+    void* pages[1] = { reinterpret_cast<void*>(
+        reinterpret_cast<uintptr_t>(address) & ~static_cast<uintptr_t>(page - 1)) };
+    int status[1] = { -1 };
+    if(syscall(SYS_move_pages, 0, 1, pages, nullptr, status, 0) != 0)
+        return -1;
+    return status[0] >= 0 ? status[0] : -1;
+#else
+    (void)address;
+    return -1;
+#endif
+}
+
+inline void ThreadPool::place_worker(size_t index)
+{
+#ifdef __linux__
+    if(worker_cpus[index].empty())
+        return;
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for(int cpu: worker_cpus[index])
+        if(cpu < CPU_SETSIZE)
+            CPU_SET(cpu, &set);
+    // best effort, a restricted cpuset simply leaves the worker unpinned
+    pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+#else
+    (void)index;
+#endif
+}
+
+inline void ThreadPool::cpu_relax()
+{
+#if defined(__x86_64__) || defined(__i386__)
+    _mm_pause();
+#endif
+}
+
+inline ThreadPool*& ThreadPool::current_pool()
+{
+    static thread_local ThreadPool* pool = nullptr;
+    return pool;
+}
+
+inline size_t& ThreadPool::current_index()
+{
+    static thread_local size_t index = 0;
+    return index;
+}
+
+// xorshift, good enough to spread steal attempts over victims
+inline uint32_t ThreadPool::next_random()
+{
+    static thread_local uint32_t state = static_cast<uint32_t>(
+        std::hash<std::thread::id>()(std::this_thread::get_id())) | 1u;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+inline ThreadPool::Task* ThreadPool::pop_inbox(Worker& worker, bool owner)
+{
+    size_t available = worker.inbox_size.load(std::memory_order_relaxed);
+    if(owner)
+        available += worker.pinned_size.load(std::memory_order_relaxed);
+    if(available == 0)
+        return nullptr;
+    std::unique_lock<std::mutex> lock(worker.inbox_mutex);
+    std::deque<Task*>& queue = owner && !worker.pinned.empty() ? worker.pinned : worker.inbox;
+    if(queue.empty())
+        return nullptr;
+    Task* task = queue.front();
+    queue.pop_front();
+    worker.inbox_size.store(worker.inbox.size(), std::memory_order_relaxed);
+    worker.pinned_size.store(worker.pinned.size(), std::memory_order_relaxed);
+    return task;
+}
+
+inline bool ThreadPool::has_work(size_t self) const
+{
+    for(auto& worker: queues)
+        if(!worker->local.empty() || worker->inbox_size.load(std::memory_order_relaxed) > 0)
+            return true;
+    return self < queues.size() && queues[self]->pinned_size.load(std::memory_order_relaxed) > 0;
+}
+
+inline size_t ThreadPool::queued() const
+{
+    size_t count = 0;
+    for(auto& worker: queues)
+        count += std::max<int64_t>(0, worker->local.size()) +
+                 worker->inbox_size.load(std::memory_order_relaxed) +
+                 worker->pinned_size.load(std::memory_order_relaxed);
+    return count;
+}
+
+// self is the calling worker's slot, or queues.size() for threads outside
+// the pool which can only steal
+inline ThreadPool::Task* ThreadPool::find_task(size_t self, bool& stolen)
+{
+    Task* task = nullptr;
+    stolen = false;
+    if(self < queues.size()) {
+        if(queues[self]->local.pop(task))
+            return task;
+        if((task = pop_inbox(*queues[self], true)))
+            return task;
+    }
+
+    // start at a random victim so thieves don't gang up on worker 0
+    size_t count = queues.size();
+    size_t start = next_random() % count;
+    stolen = true;
+    for(size_t i = 0; i < count; ++i) {
+        size_t victim = (start + i) % count;
+        if(victim == self)
+            continue;
+        if(queues[victim]->local.steal(task))
+            return task;
+        if((task = pop_inbox(*queues[victim], false)))
+            return task;
+    }
+    return nullptr;
+}
+
+inline void ThreadPool::run(size_t index)
+{
+    current_pool() = this;
+    current_index() = index;
+    place_worker(index);
+    unsigned idle_rounds = 0;
+    for(;;)
+    {
+        bool stolen;
+        Task* task = find_task(index, stolen);
+        if(task)
+        {
+            run_task(task, index, stolen);
+            idle_rounds = 0;
+            continue;
+        }
+
+        // back-to-back batches are cheaper to pick up while still awake
+        if(idle_rounds < options.spin + options.yield && !stop.load())
+        {
+            if(idle_rounds++ < options.spin)
+                cpu_relax();
+            else
+                std::this_thread::yield();
+            continue;
+        }
+        idle_rounds = 0;
+
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        bool timed = stats_enabled.load(std::memory_order_relaxed);
+        int64_t parked = timed ? now_ns() : 0;
+        sleeping.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        size_t seen = wakeups;
+        if(!stop.load() && !has_work(index))
+            condition.wait(lock, [this, seen]{ return stop.load() || wakeups != seen; });
+        sleeping.fetch_sub(1);
+        if(timed)
+        {
+            Counters& counters = queues[index]->counters;
+            counters.add(counters.idle, 1);
+            counters.add(counters.idle_ns, now_ns() - parked);
+        }
+        if(stop.load() && !has_work(index))
+            return;
+    }
+}
+
+inline int64_t ThreadPool::now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+inline ThreadPool::Counters& ThreadPool::counters_of(size_t self)
+{
+    return self < queues.size() ? queues[self]->counters : external;
+}
+
+inline void ThreadPool::run_task(Task* task, size_t self, bool stolen)
+{
+    if(!stats_enabled.load(std::memory_order_relaxed))
+    {
+        task->fn();
+        delete task;
+        return;
+    }
+
+    Counters& counters = counters_of(self);
+    int64_t start = now_ns();
+    if(task->enqueued != 0)
+    {
+        uint64_t latency = start > task->enqueued ? start - task->enqueued : 0;
+        size_t bucket = 0;
+        while(latency > 1 && bucket + 1 < latency_buckets)
+        {
+            latency >>= 1;
+            ++bucket;
+        }
+        counters.add(counters.latency[bucket], 1);
+    }
+    task->fn();
+    counters.add(counters.busy_ns, now_ns() - start);
+    counters.add(counters.tasks, 1);
+    if(stolen)
+        counters.add(counters.steals, 1);
+    delete task;
+}
+
+template<class Done, class Block>
+void ThreadPool::help_until(Done done, Block block)
+{
+    size_t self = current_pool() == this ? current_index() : queues.size();
+    while(!done())
+    {
+        bool stolen;
+        Task* task = find_task(self, stolen);
+        if(task)
+            run_task(task, self, stolen);
+        else
+            // nothing to steal, the result is being computed elsewhere
+            block();
+    }
+}
+
+template<class T>
+void ThreadPool::wait(const std::future<T>& future)
+{
+    help_until(
+        [&future]{ return future.wait_for(std::chrono::seconds(0)) == std::future_status::ready; },
+        [&future]{ future.wait_for(std::chrono::microseconds(100)); });
+}
+
+inline void ThreadPool::wait(Latch& latch)
+{
+    help_until(
+        [&latch]{ return latch.try_wait(); },
+        [&latch]{ latch.wait_for(std::chrono::microseconds(100)); });
+}
+
+inline void ThreadPool::submit(Task* task)
+{
+    if(stats_enabled.load(std::memory_order_relaxed))
+    {
+        task->enqueued = now_ns();
+        size_t depth = queued() + 1;
+        size_t peak = peak_pending.load(std::memory_order_relaxed);
+        while(depth > peak &&
+              !peak_pending.compare_exchange_weak(peak, depth, std::memory_order_relaxed))
+            ;
+    }
+    if(current_pool() == this)
+    {
+        queues[current_index()]->local.push(task);
+    }
+    else
+    {
+        Worker& worker = *queues[next_inbox.fetch_add(1,
+            std::memory_order_relaxed) % queues.size()];
+        std::unique_lock<std::mutex> lock(worker.inbox_mutex);
+        worker.inbox.push_back(task);
+        worker.inbox_size.store(worker.inbox.size(), std::memory_order_relaxed);
+    }
+    wake(false);
+}
+
+// the task is queued for exactly that worker, nobody else may steal it
+inline void ThreadPool::submit_to(size_t index, Task* task)
+{
+    task->pinned = true;
+    if(stats_enabled.load(std::memory_order_relaxed))
+        task->enqueued = now_ns();
+    Worker& worker = *queues[index];
+    {
+        std::unique_lock<std::mutex> lock(worker.inbox_mutex);
+        worker.pinned.push_back(task);
+        worker.pinned_size.store(worker.pinned.size(), std::memory_order_relaxed);
+    }
+    // notify_one might wake someone else, wake them all and let the
+    // others go back to sleep
+    wake(true);
+}
+
+// after a task was queued: the fence pairs with the one a parking worker
+// issues between counting itself in sleeping and its last look at the
+// queues, see sleeping
+inline void ThreadPool::wake(bool all)
+{
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if(sleeping.load(std::memory_order_relaxed) == 0)
+        return;
+    std::unique_lock<std::mutex> lock(sleep_mutex);
+    ++wakeups;
+    if(all)
+        condition.notify_all();
+    else
+        condition.notify_one();
 }
 
 // add new work item to the pool
 template<class F, class... Args>
-auto ThreadPool::enqueue(F&& f, Args&&... args) 
+auto ThreadPool::enqueue(F&& f, Args&&... args)
     -> std::future<typename std::result_of<F(Args...)>::type>
 {
     using return_type = typename std::result_of<F(Args...)>::type;
@@ -68,27 +709,290 @@ auto ThreadPool::enqueue(F&& f, Args&&... args)
     auto task = std::make_shared< std::packaged_task<return_type()> >(
             std::bind(std::forward<F>(f), std::forward<Args>(args)...)
         );
-        
+
     std::future<return_type> res = task->get_future();
+
+    // don't allow enqueueing after stopping the pool, workers still
+    // draining the queues may spawn children though
+    if(stop.load() && current_pool() != this)
+        throw std::runtime_error("enqueue on stopped ThreadPool");
+
+    submit(new Task([task](){ (*task)(); }));
+    return res;
+}
+
+inline ThreadPool::Splitter::Splitter(Partition partition, size_t size,
+                                     size_t grain, size_t threads)
+    :   partition(partition), size(size), grain(grain), next(0)
+{
+    if(this->grain == 0)
+        this->grain = std::max<size_t>(1, size / (8 * threads));
+    size_t chunks = (size + this->grain - 1) / this->grain;
+    runners = std::max<size_t>(1, std::min(threads, chunks));
+}
+
+inline bool ThreadPool::Splitter::claim(size_t runner, size_t& round,
+                                        size_t& first, size_t& last)
+{
+    switch(partition) {
+    case Partition::Static:
+        if(round++ != 0)
+            return false;
+        first = size * runner / runners;
+        last = size * (runner + 1) / runners;
+        return first < last;
+    case Partition::Dynamic:
+        first = next.fetch_add(grain, std::memory_order_relaxed);
+        if(first >= size)
+            return false;
+        last = std::min(size, first + grain);
+        return true;
+    case Partition::Guided:
+        first = next.load(std::memory_order_relaxed);
+        for(;;) {
+            if(first >= size)
+                return false;
+            size_t chunk = std::max(grain, (size - first) / (2 * runners));
+            last = std::min(size, first + chunk);
+            if(next.compare_exchange_weak(first, last, std::memory_order_relaxed))
+                return true;
+        }
+    }
+    return false;
+}
+
+// runs runner(0) on the calling thread and runner(1..runners-1) on the pool,
+// the first exception thrown by any of them is rethrown here. A directed
+// fork_join sends runner r to worker r; a caller outside the pool then
+// runs nothing itself so that every runner lands on the same worker.
+template<class Runner>
+void ThreadPool::fork_join(size_t runners, Runner& runner, bool directed)
+{
+    size_t inline_runners = directed && current_pool() != this ? 0 : 1;
+    Latch latch(runners - inline_runners);
+    std::exception_ptr error;
+    std::mutex error_mutex;
+    auto guarded = [&runner, &error, &error_mutex](size_t r) {
+        try {
+            runner(r);
+        } catch(...) {
+            std::unique_lock<std::mutex> lock(error_mutex);
+            if(!error)
+                error = std::current_exception();
+        }
+    };
+
+    for(size_t r = inline_runners; r < runners; ++r) {
+        Task* task = new Task([&guarded, &latch, r] {
+            guarded(r);
+            latch.count_down();
+        });
+        if(directed)
+            submit_to(r, task);
+        else
+            submit(task);
+    }
+    if(inline_runners)
+        guarded(0);
+    wait(latch);
+
+    if(error)
+        std::rethrow_exception(error);
+}
+
+template<class Index, class F>
+void ThreadPool::parallel_range(Index begin, Index end, Index grain, F&& fn,
+                                Partition partition)
+{
+    if(!(begin < end))
+        return;
+    Splitter splitter(partition, static_cast<size_t>(end - begin),
+                      static_cast<size_t>(grain), size());
+    if(splitter.runners == 1) {
+        fn(begin, end);
+        return;
+    }
+
+    auto runner = [&splitter, &fn, begin](size_t r) {
+        size_t round = 0, first, last;
+        while(splitter.claim(r, round, first, last))
+            fn(static_cast<Index>(begin + first), static_cast<Index>(begin + last));
+    };
+    fork_join(splitter.runners, runner, directed(partition));
+}
+
+template<class Index, class F>
+void ThreadPool::parallel_for(Index begin, Index end, Index grain, F&& fn,
+                              Partition partition)
+{
+    parallel_range(begin, end, grain, [&fn](Index first, Index last) {
+        for(Index i = first; i < last; ++i)
+            fn(i);
+    }, partition);
+}
+
+template<class Index, class T, class Map, class Combine>
+T ThreadPool::parallel_reduce(Index begin, Index end, Index grain, T identity,
+                              Map&& map, Combine&& combine, Partition partition)
+{
+    if(!(begin < end))
+        return identity;
+    Splitter splitter(partition, static_cast<size_t>(end - begin),
+                      static_cast<size_t>(grain), size());
+    if(splitter.runners == 1)
+        return combine(identity, map(begin, end));
+
+    std::vector<T> partial(splitter.runners, identity);
+    auto runner = [&splitter, &map, &combine, &partial, begin](size_t r) {
+        size_t round = 0, first, last;
+        T acc = partial[r];
+        while(splitter.claim(r, round, first, last))
+            acc = combine(acc, map(static_cast<Index>(begin + first),
+                                   static_cast<Index>(begin + last)));
+        partial[r] = acc;
+    };
+    fork_join(splitter.runners, runner, directed(partition));
+
+    T result = identity;
+    for(const T& value: partial)
+        result = combine(result, value);
+    return result;
+}
+
+template<class F>
+void ThreadPool::post(F&& f)
+{
+    if(stop.load() && current_pool() != this)
+        throw std::runtime_error("post on stopped ThreadPool");
+
+    submit(new Task(std::forward<F>(f)));
+}
+
+template<class F>
+void ThreadPool::post_on_node(int node, F&& f)
+{
+    if(stop.load() && current_pool() != this)
+        throw std::runtime_error("post on stopped ThreadPool");
+
+    std::vector<size_t> candidates;
+    for(size_t i = 0; i < worker_node.size(); ++i)
+        if(worker_node[i] == node)
+            candidates.push_back(i);
+    if(candidates.empty()) {
+        submit(new Task(std::forward<F>(f)));
+        return;
+    }
+    size_t pick = next_inbox.fetch_add(1, std::memory_order_relaxed) % candidates.size();
+    submit_to(candidates[pick], new Task(std::forward<F>(f)));
+}
+
+inline void ThreadPool::Counters::reset()
+{
+    tasks.store(0);
+    steals.store(0);
+    idle.store(0);
+    idle_ns.store(0);
+    busy_ns.store(0);
+    for(size_t i = 0; i < latency_buckets; ++i)
+        latency[i].store(0);
+}
+
+inline ThreadPool::WorkerStats ThreadPool::Counters::snapshot() const
+{
+    WorkerStats stats;
+    stats.tasks = tasks.load(std::memory_order_relaxed);
+    stats.steals = steals.load(std::memory_order_relaxed);
+    stats.idle = idle.load(std::memory_order_relaxed);
+    stats.idle_ns = idle_ns.load(std::memory_order_relaxed);
+    stats.busy_ns = busy_ns.load(std::memory_order_relaxed);
+    for(size_t i = 0; i < latency_buckets; ++i)
+        stats.latency.push_back(latency[i].load(std::memory_order_relaxed));
+    return stats;
+}
+
+inline ThreadPool::WorkerStats ThreadPool::Stats::total() const
+{
+    WorkerStats sum = external;
+    for(const WorkerStats& worker: workers)
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
+        sum.tasks += worker.tasks;
+        sum.steals += worker.steals;
+        sum.idle += worker.idle;
+        sum.idle_ns += worker.idle_ns;
+        sum.busy_ns += worker.busy_ns;
+        for(size_t i = 0; i < latency_buckets; ++i)
+            sum.latency[i] += worker.latency[i];
+    }
+    return sum;
+}
 
-        // don't allow enqueueing after stopping the pool
-        if(stop)
-            throw std::runtime_error("enqueue on stopped ThreadPool");
+inline std::string ThreadPool::Stats::to_json() const
+{
+    auto dump = [](std::ostringstream& out, const WorkerStats& worker) {
+        out << "{\"tasks\":" << worker.tasks
+            << ",\"steals\":" << worker.steals
+            << ",\"idle\":" << worker.idle
+            << ",\"idle_ns\":" << worker.idle_ns
+            << ",\"busy_ns\":" << worker.busy_ns
+            << ",\"latency_log2_ns\":[";
+        // drop the empty tail of the histogram
+        size_t used = worker.latency.size();
+        while(used > 0 && worker.latency[used - 1] == 0)
+            --used;
+        for(size_t i = 0; i < used; ++i)
+            out << (i ? "," : "") << worker.latency[i];
+        out << "]}";
+    };
 
-        tasks.emplace([task](){ (*task)(); });
+    std::ostringstream out;
+    out << "{\"threads\":" << workers.size()
+        << ",\"pending\":" << pending
+        << ",\"peak_pending\":" << peak_pending
+        << ",\"total\":";
+    dump(out, total());
+    out << ",\"external\":";
+    dump(out, external);
+    out << ",\"workers\":[";
+    for(size_t i = 0; i < workers.size(); ++i)
+    {
+        if(i)
+            out << ",";
+        dump(out, workers[i]);
     }
-    condition.notify_one();
-    return res;
+    out << "]}";
+    return out.str();
+}
+
+inline void ThreadPool::enable_stats(bool enabled)
+{
+    stats_enabled.store(enabled);
+}
+
+inline void ThreadPool::reset_stats()
+{
+    for(auto& worker: queues)
+        worker->counters.reset();
+    external.reset();
+    peak_pending.store(queued());
+}
+
+inline ThreadPool::Stats ThreadPool::stats() const
+{
+    Stats stats;
+    for(auto& worker: queues)
+        stats.workers.push_back(worker->counters.snapshot());
+    stats.external = external.snapshot();
+    stats.pending = queued();
+    stats.peak_pending = peak_pending.load();
+    return stats;
 }
 
 // the destructor joins all threads
 inline ThreadPool::~ThreadPool()
 {
     {
-        std::unique_lock<std::mutex> lock(queue_mutex);
-        stop = true;
+        std::unique_lock<std::mutex> lock(sleep_mutex);
+        stop.store(true);
     }
     condition.notify_all();
     for(std::thread &worker: workers)
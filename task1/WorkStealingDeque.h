@@ -0,0 +1,153 @@
+#ifndef WORK_STEALING_DEQUE_H
+#define WORK_STEALING_DEQUE_H
+
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <cstdint>
+
+// Chase-Lev work-stealing deque (Le, Pop, Cohen, Zappa Nardelli, PPoPP'13).
+// The owning thread pushes and pops at the bottom (LIFO), any other thread
+// may steal from the top (FIFO). Only pointer-like T is supported because
+// slots are accessed through std::atomic<T>.
+template<class T>
+class WorkStealingDeque {
+public:
+    explicit WorkStealingDeque(int64_t capacity = 1024);
+    ~WorkStealingDeque();
+
+    WorkStealingDeque(const WorkStealingDeque&) = delete;
+    WorkStealingDeque& operator=(const WorkStealingDeque&) = delete;
+
+    // owner only
+    void push(T item);
+    bool pop(T& item);
+
+    // any thread
+    bool steal(T& item);
+    bool empty() const;
+    int64_t size() const;
+private:
+    struct Array {
+        int64_t capacity;
+        int64_t mask;
+        std::atomic<T>* slots;
+
+        explicit Array(int64_t c)
+            : capacity(c), mask(c - 1), slots(new std::atomic<T>[c]) {}
+        ~Array() { delete [] slots; }
+
+        T get(int64_t i) const
+        {
+            return slots[i & mask].load(std::memory_order_relaxed);
+        }
+        void put(int64_t i, T item)
+        {
+            slots[i & mask].store(item, std::memory_order_relaxed);
+        }
+        Array* grow(int64_t bottom, int64_t top) const
+        {
+            Array* bigger = new Array(capacity * 2);
+            for(int64_t i = top; i != bottom; ++i)
+                bigger->put(i, get(i));
+            return bigger;
+        }
+    };
+
+    std::atomic<int64_t> top;
+    std::atomic<int64_t> bottom;
+    std::atomic<Array*> array;
+    // thieves may still read a retired array, so it lives until destruction
+    std::vector< std::unique_ptr<Array> > garbage;
+};
+
+template<class T>
+WorkStealingDeque<T>::WorkStealingDeque(int64_t capacity)
+    :   top(0), bottom(0)
+{
+    // capacity must be a power of two for the index mask
+    int64_t c = 1;
+    while(c < capacity)
+        c <<= 1;
+    array.store(new Array(c), std::memory_order_relaxed);
+}
+
+template<class T>
+WorkStealingDeque<T>::~WorkStealingDeque()
+{
+    delete array.load(std::memory_order_relaxed);
+}
+
+template<class T>
+void WorkStealingDeque<T>::push(T item)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_acquire);
+    Array* a = array.load(std::memory_order_relaxed);
+    if(b - t > a->capacity - 1) {
+        Array* bigger = a->grow(b, t);
+        garbage.emplace_back(a);
+        array.store(bigger, std::memory_order_release);
+        a = bigger;
+    }
+    a->put(b, item);
+    // publishes the item to thieves, whose load of bottom acquires
+    bottom.store(b + 1, std::memory_order_release);
+}
+
+template<class T>
+bool WorkStealingDeque<T>::pop(T& item)
+{
+    int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+    Array* a = array.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t t = top.load(std::memory_order_relaxed);
+
+    if(t > b) {
+        // empty
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return false;
+    }
+
+    item = a->get(b);
+    if(t == b) {
+        // last element, race against thieves for it
+        bool won = top.compare_exchange_strong(t, t + 1,
+            std::memory_order_seq_cst, std::memory_order_relaxed);
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return won;
+    }
+    return true;
+}
+
+template<class T>
+bool WorkStealingDeque<T>::steal(T& item)
+{
+    int64_t t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = bottom.load(std::memory_order_acquire);
+    if(t >= b)
+        return false;
+
+    Array* a = array.load(std::memory_order_acquire);
+    item = a->get(t);
+    return top.compare_exchange_strong(t, t + 1,
+        std::memory_order_seq_cst, std::memory_order_relaxed);
+}
+
+template<class T>
+bool WorkStealingDeque<T>::empty() const
+{
+    return size() <= 0;
+}
+
+template<class T>
+int64_t WorkStealingDeque<T>::size() const
+{
+    int64_t b = bottom.load(std::memory_order_relaxed);
+    int64_t t = top.load(std::memory_order_relaxed);
+    return b - t;
+}
+
+#endif
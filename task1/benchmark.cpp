@@ -0,0 +1,390 @@
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <chrono>
+#include <memory>
+#include <fstream>
+#include <stdexcept>
+#include <cstdio>
+#include <cstdlib>
+#include <cstdint>
+#include <unistd.h>
+
+#if __cplusplus >= 201703L && defined(__has_include)
+#if __has_include(<execution>)
+#include <execution>
+#define HAVE_STD_EXECUTION 1
+#endif
+#endif
+
+#include "PrefixSum.h"
+#include "StreamScan.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Prefix sum benchmark. Every variant of PrefixSum.h plus the standard
+// library ones is run over power of two sizes (L1 resident up to far past
+// the last level cache) and, for the variants that run on a pool, over a
+// list of thread counts. Each point gets warm-up runs and then timed
+// repetitions; the input is restored before every run and only the scan
+// itself is timed. The result of the last run is compared with a serial
+// reference. Inputs are integers 1..1000 from a fixed seed, so every sum is
+// exact in a double and results must match bit for bit. For every thread
+// count, the pages of the work array are first touched block by block by
+// the pool's workers (placedCopy), so on a NUMA machine the blocked scans
+// read local memory.
+//
+// The stream variant scans a file into a file. Its input is written before
+// and its output read back after the timed part, which is the file scan
+// alone with the input still in the page cache.
+//
+//   benchmark [--min-log N] [--max-log N] [--threads 1,2,4] [--reps N]
+//             [--warmup N] [--variants a,b] [--qt-max-log N] [--json]
+//
+// Output is CSV on stdout (--json for one JSON document); the exit status
+// is non-zero if any variant produced a wrong result.
+
+struct BenchmarkOptions
+{
+    size_t minLog = 10;
+    size_t maxLog = 25;
+    std::vector<size_t> threads;
+    size_t reps = 15;
+    size_t warmup = 2;
+    std::vector<std::string> variants;
+    // parallelQtPrefixSum starts one task per tree node
+    size_t qtMaxLog = 18;
+    bool json = false;
+};
+
+// what a variant runs on for the current point
+struct BenchmarkContext
+{
+    ThreadPool* pool;
+    QThreadPool* qtPool;
+    const std::vector<uint8_t>* heads;
+    // scratch files of the stream variant
+    std::string streamIn;
+    std::string streamOut;
+};
+
+struct Variant
+{
+    std::string name;
+    bool exclusive;
+    // 0: runs with the thread count under test, otherwise the fixed number
+    // of threads it uses whatever the sweep says
+    size_t fixedThreads;
+    size_t maxLog;
+    std::function<void(BenchmarkContext&, std::vector<double>&)> run;
+    // optional, untimed: before run, and after it to bring the result back
+    // into the array
+    std::function<void(BenchmarkContext&, std::vector<double>&)> prepare = nullptr;
+    std::function<void(BenchmarkContext&, std::vector<double>&)> collect = nullptr;
+};
+
+struct Result
+{
+    std::string variant;
+    size_t size;
+    size_t threads;
+    std::vector<double> ms;
+    bool ok;
+};
+
+void writeDoubles(const std::string& path, const std::vector<double>& arr)
+{
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    out.write(reinterpret_cast<const char*>(arr.data()), arr.size()*sizeof(double));
+    if(!out.flush())
+        throw std::runtime_error("cannot write " + path);
+}
+
+void readDoubles(const std::string& path, std::vector<double>& arr)
+{
+    std::ifstream in(path, std::ios::binary);
+    in.read(reinterpret_cast<char*>(arr.data()), arr.size()*sizeof(double));
+    if(!in)
+        throw std::runtime_error("cannot read " + path);
+}
+
+std::vector<Variant> makeVariants(const BenchmarkOptions& options)
+{
+    size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+    size_t any = 64;
+    std::vector<Variant> variants;
+    variants.push_back({"serial", false, 1, any, [](BenchmarkContext&, std::vector<double>& arr)
+    {
+        normalPrefixSum(arr);
+    }});
+    variants.push_back({"std::partial_sum", false, 1, any, [](BenchmarkContext&, std::vector<double>& arr)
+    {
+        std::partial_sum(arr.begin(), arr.end(), arr.begin());
+    }});
+#ifdef HAVE_STD_EXECUTION
+    variants.push_back({"std::inclusive_scan(seq)", false, 1, any, [](BenchmarkContext&, std::vector<double>& arr)
+    {
+        std::inclusive_scan(std::execution::seq, arr.begin(), arr.end(), arr.begin());
+    }});
+    // the standard library picks its own thread count
+    variants.push_back({"std::inclusive_scan(par)", false, hardware, any, [](BenchmarkContext&, std::vector<double>& arr)
+    {
+        std::inclusive_scan(std::execution::par, arr.begin(), arr.end(), arr.begin());
+    }});
+    variants.push_back({"std::inclusive_scan(par_unseq)", false, hardware, any, [](BenchmarkContext&, std::vector<double>& arr)
+    {
+        std::inclusive_scan(std::execution::par_unseq, arr.begin(), arr.end(), arr.begin());
+    }});
+#endif
+    variants.push_back({std::string("simd(") + simdLevelName(simdLevel()) + ")", false, 1, any,
+                        [](BenchmarkContext&, std::vector<double>& arr)
+    {
+        simdPrefixSum(arr);
+    }});
+    variants.push_back({"blelloch", true, 0, any, [](BenchmarkContext& context, std::vector<double>& arr)
+    {
+        parallelPrefixSum(*context.pool, arr);
+    }});
+    variants.push_back({"blelloch-graph", true, 0, any, [](BenchmarkContext& context, std::vector<double>& arr)
+    {
+        parallelGraphPrefixSum(*context.pool, arr);
+    }});
+    variants.push_back({"blelloch-qt", true, 0, options.qtMaxLog, [](BenchmarkContext& context, std::vector<double>& arr)
+    {
+        parallelQtPrefixSum(context.qtPool, arr);
+    }});
+    variants.push_back({"reduce-then-scan", true, 0, any, [](BenchmarkContext& context, std::vector<double>& arr)
+    {
+        blockedPrefixSum(*context.pool, arr);
+    }});
+    variants.push_back({"look-back", true, 0, any, [](BenchmarkContext& context, std::vector<double>& arr)
+    {
+        lookBackPrefixSum(*context.pool, arr);
+    }});
+    // a single segment, so this is the cost of the head checks on top of
+    // reduce-then-scan
+    variants.push_back({"segmented", false, 0, any, [](BenchmarkContext& context, std::vector<double>& arr)
+    {
+        segmentedPrefixSum(*context.pool, arr, *context.heads);
+    }});
+    variants.push_back({"stream", false, 0, any, [](BenchmarkContext& context, std::vector<double>&)
+    {
+        streamInclusiveScan<double>(*context.pool, context.streamIn, context.streamOut);
+    }, [](BenchmarkContext& context, std::vector<double>& arr)
+    {
+        writeDoubles(context.streamIn, arr);
+    }, [](BenchmarkContext& context, std::vector<double>& arr)
+    {
+        readDoubles(context.streamOut, arr);
+    }});
+
+    if(!options.variants.empty())
+    {
+        variants.erase(std::remove_if(variants.begin(), variants.end(), [&](const Variant& variant)
+        {
+            return std::find(options.variants.begin(), options.variants.end(), variant.name) == options.variants.end();
+        }), variants.end());
+    }
+    return variants;
+}
+
+std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while(std::getline(stream, item, ','))
+        if(!item.empty())
+            items.push_back(item);
+    return items;
+}
+
+bool parseOptions(int argc, char* argv[], BenchmarkOptions& options)
+{
+    for(int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if(arg == "--json")
+        {
+            options.json = true;
+            continue;
+        }
+        if(i + 1 == argc)
+            return false;
+        std::string value = argv[++i];
+        if(arg == "--min-log")
+            options.minLog = std::stoul(value);
+        else if(arg == "--max-log")
+            options.maxLog = std::stoul(value);
+        else if(arg == "--reps")
+            options.reps = std::max<size_t>(1, std::stoul(value));
+        else if(arg == "--warmup")
+            options.warmup = std::stoul(value);
+        else if(arg == "--qt-max-log")
+            options.qtMaxLog = std::stoul(value);
+        else if(arg == "--variants")
+            options.variants = splitList(value);
+        else if(arg == "--threads")
+        {
+            options.threads.clear();
+            for(const std::string& item: splitList(value))
+                options.threads.push_back(std::max<size_t>(1, std::stoul(item)));
+        }
+        else
+            return false;
+    }
+
+    // default sweep: powers of two up to the hardware, and the hardware
+    if(options.threads.empty())
+    {
+        size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        for(size_t t = 1; t < hardware; t *= 2)
+            options.threads.push_back(t);
+        options.threads.push_back(hardware);
+    }
+    return options.minLog <= options.maxLog && options.maxLog < 40;
+}
+
+// nearest rank percentile of sorted times
+double percentile(const std::vector<double>& sorted, double q)
+{
+    return sorted[std::min(sorted.size() - 1, size_t(q*(sorted.size() - 1) + 0.5))];
+}
+
+Result measure(const Variant& variant, BenchmarkContext& context, size_t threads,
+               const std::vector<double>& input, const std::vector<double>& reference,
+               std::vector<double>& work, const BenchmarkOptions& options)
+{
+    Result result = {variant.name, input.size(), threads, {}, false};
+    for(size_t rep = 0; rep < options.warmup + options.reps; ++rep)
+    {
+        std::copy(input.begin(), input.end(), work.begin());
+        if(variant.prepare)
+            variant.prepare(context, work);
+        steady_clock::time_point start = steady_clock::now();
+        variant.run(context, work);
+        steady_clock::time_point end = steady_clock::now();
+        if(variant.collect)
+            variant.collect(context, work);
+        if(rep >= options.warmup)
+            result.ms.push_back(duration_cast<duration<double, std::milli> >(end - start).count());
+    }
+    result.ok = work == reference;
+    std::sort(result.ms.begin(), result.ms.end());
+    return result;
+}
+
+// bytes read and written by one scan
+double gigabytesPerSecond(const Result& result)
+{
+    return 2.0 * result.size * sizeof(double) / (percentile(result.ms, 0.5) * 1e-3) / 1e9;
+}
+
+void printCsv(std::ostream& out, const std::vector<Result>& results)
+{
+    out << "variant,size,bytes,threads,reps,min_ms,p10_ms,median_ms,p90_ms,max_ms,gbps,ok\n";
+    for(const Result& result: results)
+    {
+        out << result.variant << ',' << result.size << ',' << result.size * sizeof(double) << ','
+            << result.threads << ',' << result.ms.size() << ','
+            << result.ms.front() << ',' << percentile(result.ms, 0.1) << ','
+            << percentile(result.ms, 0.5) << ',' << percentile(result.ms, 0.9) << ','
+            << result.ms.back() << ',' << gigabytesPerSecond(result) << ','
+            << (result.ok ? "true" : "false") << '\n';
+    }
+}
+
+void printJson(std::ostream& out, const std::vector<Result>& results, const BenchmarkOptions& options)
+{
+    out << "{\"simd\":\"" << simdLevelName(simdLevel()) << "\""
+        << ",\"hardware_threads\":" << std::thread::hardware_concurrency()
+        << ",\"reps\":" << options.reps << ",\"warmup\":" << options.warmup
+        << ",\"results\":[";
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& result = results[i];
+        out << (i ? ",\n" : "\n")
+            << "{\"variant\":\"" << result.variant << "\",\"size\":" << result.size
+            << ",\"bytes\":" << result.size * sizeof(double) << ",\"threads\":" << result.threads
+            << ",\"min_ms\":" << result.ms.front() << ",\"p10_ms\":" << percentile(result.ms, 0.1)
+            << ",\"median_ms\":" << percentile(result.ms, 0.5) << ",\"p90_ms\":" << percentile(result.ms, 0.9)
+            << ",\"max_ms\":" << result.ms.back() << ",\"gbps\":" << gigabytesPerSecond(result)
+            << ",\"ok\":" << (result.ok ? "true" : "false") << "}";
+    }
+    out << "\n]}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    if(!parseOptions(argc, argv, options))
+    {
+        cerr << "usage: " << argv[0] << " [--min-log N] [--max-log N] [--threads 1,2,4] [--reps N]"
+                " [--warmup N] [--variants a,b] [--qt-max-log N] [--json]" << endl;
+        return 2;
+    }
+    std::vector<Variant> variants = makeVariants(options);
+
+    const char* tmp = std::getenv("TMPDIR");
+    std::string scratch = std::string(tmp ? tmp : "/tmp") + "/prefix_sum_" + std::to_string(getpid());
+
+    std::mt19937 gen(42);
+    std::uniform_int_distribution<> dis(1, 1000);
+
+    std::vector<Result> results;
+    for(size_t log = options.minLog; log <= options.maxLog; ++log)
+    {
+        size_t size = size_t(1) << log;
+        std::vector<double> input(size);
+        std::generate(input.begin(), input.end(), [&](){return dis(gen);});
+
+        std::vector<double> inclusive(input);
+        normalPrefixSum(inclusive);
+        std::vector<double> exclusive(size);
+        exclusive[0] = 0;
+        std::copy(inclusive.begin(), inclusive.end() - 1, exclusive.begin() + 1);
+
+        std::vector<uint8_t> heads(size);
+        heads[0] = 1;
+        std::vector<double> work(size);
+
+        for(size_t t = 0; t < options.threads.size(); ++t)
+        {
+            size_t threads = options.threads[t];
+            ThreadPool pool(sweepPoolOptions(threads));
+            QThreadPool qtPool;
+            qtPool.setMaxThreadCount(threads);
+            BenchmarkContext context = {&pool, &qtPool, &heads, scratch + ".in", scratch + ".out"};
+            // the pages of work go to the workers of this pool, block by block
+            placedCopy(pool, input, work);
+
+            for(const Variant& variant: variants)
+            {
+                // fixed thread count variants are measured once per size
+                if(log > variant.maxLog || (variant.fixedThreads && t > 0))
+                    continue;
+                results.push_back(measure(variant, context, variant.fixedThreads ? variant.fixedThreads : threads,
+                                          input, variant.exclusive ? exclusive : inclusive, work, options));
+                if(!results.back().ok)
+                    cerr << variant.name << " gave a wrong result for size " << size << endl;
+            }
+        }
+    }
+
+    std::remove((scratch + ".in").c_str());
+    std::remove((scratch + ".out").c_str());
+
+    if(options.json)
+        printJson(cout, results, options);
+    else
+        printCsv(cout, results);
+
+    bool ok = std::all_of(results.begin(), results.end(), [](const Result& result){ return result.ok; });
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,16 @@
+QT += core concurrent
+QT -= gui
+
+TARGET = benchmark
+CONFIG += console release
+CONFIG -= app_bundle
+
+# std::inclusive_scan with execution policies
+CONFIG += c++17
+
+TEMPLATE = app
+
+SOURCES += benchmark.cpp
+
+# libstdc++ runs the parallel execution policies on TBB when it is installed
+unix:exists(/usr/include/tbb/tbb.h): LIBS += -ltbb
@@ -7,8 +7,8 @@
 #include <chrono>
 
 #include "ThreadPool.h"
-#include <QThreadPool>
-#include <QtConcurrent>
+#include "StreamScan.h"
+#include "PrefixSum.h"
 
 using namespace std;
 using namespace std::chrono;
@@ -24,128 +24,33 @@ void printArr(std::vector<double>& arr)
 }
 
 
-void parallelPrefixSum(std::vector<double>& arr)
-{
-    size_t size = arr.size();
-    unsigned int n = std::thread::hardware_concurrency();
-    ThreadPool pool(n);
-    std::vector< std::future<void> > results;
-
-    size_t depth = log2 (size);
-    for(size_t d = 0; d < depth; ++d) {
-
-        size_t works = std::pow (2, depth - d - 1);
-
-        for(size_t k = 0; k < works; ++k)
-        {
-            results.emplace_back(
-                pool.enqueue(
-                [d, k, &arr]
-                {
-                    int arraySize = std::pow (2, d + 1);
-                    int arrayStart = k*arraySize;
-                    arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
-                    return;
-                })
-            );
-        }
-        for(auto && result: results)
-            result.get();
-        results.clear();
-    }
-
-    arr[size-1] = 0;
-
-    for(int d = depth-1; d >= 0; --d) {
-
-        int works = std::pow (2, depth - d - 1);
-
-        for(int k = 0; k < works; ++k)
-        {
-            results.emplace_back(
-                pool.enqueue(
-                [d, k, &arr]
-                {
-                    int arraySize = std::pow (2, d + 1);
-                    int arrayStart = k*arraySize;
-                    int temp =  arr[arrayStart + arraySize - 1];
-                    arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
-                    arr[arrayStart + arraySize/2 - 1] = temp;
-                    return;
-                })
-            );
-        }
-        for(auto && result: results)
-            result.get();
-        results.clear();
-    }
-
-}
+volatile int GlobalVar = 10;
 
-void parallelQtPrefixSum(std::vector<double>& arr)
+// main --stream in.bin out.bin: out-of-core prefix sum of a column of doubles
+int streamPrefixSum(const std::string& inPath, const std::string& outPath)
 {
-    size_t size = arr.size();
-    std::vector< QFuture<void> > results;
-
-    size_t depth = log2 (size);
-    for(size_t d = 0; d < depth; ++d) {
-
-        size_t works = std::pow (2, depth - d - 1);
-
-        for(size_t k = 0; k < works; ++k)
-        {
-            results.push_back(QtConcurrent::run(QThreadPool::globalInstance(), [d, k, &arr]
-            {
-                int arraySize = std::pow (2, d + 1);
-                int arrayStart = k*arraySize;
-                arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
-                return;
-            }));
-        }
-        for(auto && result: results)
-            result.waitForFinished();
-        results.clear();
-    }
-
-    arr[size-1] = 0;
-
-    for(int d = depth-1; d >= 0; --d) {
-
-        int works = std::pow (2, depth - d - 1);
-
-        for(int k = 0; k < works; ++k)
-        {
-            results.push_back(QtConcurrent::run(QThreadPool::globalInstance(), [d, k, &arr]
-            {
-                int arraySize = std::pow (2, d + 1);
-                int arrayStart = k*arraySize;
-                int temp =  arr[arrayStart + arraySize - 1];
-                arr[arrayStart + arraySize - 1] += arr[arrayStart + arraySize/2 - 1];
-                arr[arrayStart + arraySize/2 - 1] = temp;
-                return;
-            }));
-        }
-        for(auto && result: results)
-            result.waitForFinished();
-        results.clear();
-    }
-
+    ThreadPool pool(std::thread::hardware_concurrency());
+    high_resolution_clock::time_point start = high_resolution_clock::now();
+    double total = streamInclusiveScan<double>(pool, inPath, outPath);
+    high_resolution_clock::time_point end = high_resolution_clock::now();
+
+    struct stat info;
+    stat(inPath.c_str(), &info);
+    double seconds = duration_cast<duration<double> >( end - start ).count();
+    cout << "streamPrefixSum total " << total << " execution time " <<
+            duration_cast<milliseconds>( end - start ).count() << " milliseconds, " <<
+            info.st_size / seconds / 1e9 << " GB/s" << endl;
+    return 0;
 }
 
-void normalPrefixSum(std::vector<double>& arr)
+int main(int argc, char* argv[])
 {
-    cout << "operations count " << arr.size() << endl;
-    for (size_t i = 1; i < arr.size(); ++i)
-    {
-        volatile double* ptr = &arr[i];
-        *ptr = arr[i-1] + *ptr;
-    }
-}
+    if(argc == 4 && std::string(argv[1]) == "--stream")
+        return streamPrefixSum(argv[2], argv[3]);
 
-volatile int GlobalVar = 10;
+    // --stats dumps ThreadPool statistics of parallelPrefixSum to stderr
+    bool printStats = argc > 1 && std::string(argv[1]) == "--stats";
 
-int main()
-{
     unsigned int n = std::thread::hardware_concurrency();
     std::cout << n << " concurrent threads are supported.\n";
 
@@ -159,6 +64,7 @@ int main()
     std::generate(arr.begin(), arr.end(), [&](){return dis(gen);});
 
     std::vector<double> copy1(arr.begin(), arr.end());
+    cout << "operations count " << size << endl;
     //printArr(copy2);
     high_resolution_clock::time_point start1 = high_resolution_clock::now();
     //std::partial_sum (arr.begin(), arr.end(), copy1.begin());
@@ -172,13 +78,59 @@ int main()
     std::vector<double> copy2(arr.begin(), arr.end());
     //printArr(copy2);
     high_resolution_clock::time_point start2 = high_resolution_clock::now();
-    parallelPrefixSum(copy2);
+    parallelPrefixSum(copy2, printStats ? &cerr : nullptr);
     high_resolution_clock::time_point end2 = high_resolution_clock::now();
     GlobalVar = copy2[size-1];
     //printArr(copy2);
     cout << "parallelPrefixSum execution time " <<
             duration_cast<milliseconds>( end2 - start2 ).count() << " milliseconds" << endl;
 
+    std::vector<double> copy3(arr.begin(), arr.end());
+    high_resolution_clock::time_point start3 = high_resolution_clock::now();
+    parallelGraphPrefixSum(copy3);
+    high_resolution_clock::time_point end3 = high_resolution_clock::now();
+    GlobalVar = copy3[size-1];
+    cout << "parallelGraphPrefixSum execution time " <<
+            duration_cast<milliseconds>( end3 - start3 ).count() << " milliseconds" << endl;
+
+    std::vector<double> copy6(arr.begin(), arr.end());
+    high_resolution_clock::time_point start6 = high_resolution_clock::now();
+    simdPrefixSum(copy6);
+    high_resolution_clock::time_point end6 = high_resolution_clock::now();
+    GlobalVar = copy6[size-1];
+    cout << "simdPrefixSum (" << simdLevelName(simdLevel()) << ") execution time " <<
+            duration_cast<milliseconds>( end6 - start6 ).count() << " milliseconds" << endl;
+
+    // the blocked scans get their input placed by the workers that scan it,
+    // so on a NUMA machine every block is read from local memory
+    ThreadPool placed(sweepPoolOptions(n));
+    std::vector<double> copy5;
+    placedCopy(placed, arr, copy5);
+    high_resolution_clock::time_point start5 = high_resolution_clock::now();
+    blockedPrefixSum(placed, copy5);
+    high_resolution_clock::time_point end5 = high_resolution_clock::now();
+    GlobalVar = copy5[size-1];
+    cout << "blockedPrefixSum execution time " <<
+            duration_cast<milliseconds>( end5 - start5 ).count() << " milliseconds" << endl;
+
+    std::vector<double> copy7;
+    placedCopy(placed, arr, copy7);
+    high_resolution_clock::time_point start7 = high_resolution_clock::now();
+    lookBackPrefixSum(placed, copy7);
+    high_resolution_clock::time_point end7 = high_resolution_clock::now();
+    GlobalVar = copy7[size-1];
+    cout << "lookBackPrefixSum execution time " <<
+            duration_cast<milliseconds>( end7 - start7 ).count() << " milliseconds" << endl;
+
+    std::vector<double> copy8(arr.begin(), arr.end());
+    std::uniform_int_distribution<size_t> segment(1, 4096);
+    high_resolution_clock::time_point start8 = high_resolution_clock::now();
+    segmentedPrefixSum(copy8, [&](){return segment(gen);});
+    high_resolution_clock::time_point end8 = high_resolution_clock::now();
+    GlobalVar = copy8[size-1];
+    cout << "segmentedPrefixSum execution time " <<
+            duration_cast<milliseconds>( end8 - start8 ).count() << " milliseconds" << endl;
+
     std::vector<double> copy4(arr.begin(), arr.end());
     //printArr(copy2);
     high_resolution_clock::time_point start4 = high_resolution_clock::now();
@@ -0,0 +1,246 @@
+#ifndef FIXED_MATRIX_H
+#define FIXED_MATRIX_H
+
+#include <cstddef>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+#include "MatrixView.h"
+#include "GemmKernels.h"
+
+// Small matrices with the size in the type. FixedMatrix<T, N> is a plain
+// value, no heap, and its product has every bound known to the compiler.
+//
+// For many independent products of one size, MatrixBatch<T, N> stores
+// the matrices interleaved: the batch is cut into groups of lanes
+// matrices, lanes being the elements of T in a cache line, and within a
+// group element (i, j) of all of them is one aligned line, matrix m of
+// the group in lane m. A kernel then multiplies a whole group at once
+// with plain vector arithmetic, one vector lane per matrix, and needs no
+// shuffles or horizontal sums whatever N is. Groups are independent, so
+// a batch splits over a pool at group granularity.
+
+#if defined(__GNUC__) && !defined(__clang__)
+#define FIXED_UNROLL _Pragma("GCC unroll 32")
+#else
+#define FIXED_UNROLL
+#endif
+
+template<class T, int N>
+struct FixedMatrix
+{
+    T data[N][N];
+
+    T& operator()(int i, int j)
+    {
+        return data[i][j];
+    }
+
+    T operator()(int i, int j) const
+    {
+        return data[i][j];
+    }
+};
+
+template<class T, int N>
+FixedMatrix<T, N> operator*(const FixedMatrix<T, N>& a, const FixedMatrix<T, N>& b)
+{
+    FixedMatrix<T, N> c = {};
+    for (int i = 0; i < N; ++i)
+    {
+        for (int k = 0; k < N; ++k)
+        {
+            T x = a.data[i][k];
+            for (int j = 0; j < N; ++j)
+            {
+                c.data[i][j] += x * b.data[k][j];
+            }
+        }
+    }
+    return c;
+}
+
+template<class T, int N>
+class MatrixBatch
+{
+public:
+    static const int lanes = matrixAlignment / sizeof(T);
+    // elements of one group
+    static const size_t groupSize = size_t(N) * N * lanes;
+
+    // count zero matrices
+    explicit MatrixBatch(size_t count)
+        : count(count), storage(groupsOf(count) * groupSize)
+    {
+    }
+
+    size_t size() const
+    {
+        return count;
+    }
+
+    size_t groups() const
+    {
+        return groupsOf(count);
+    }
+
+    // element (i, j) of matrix m
+    T& operator()(size_t m, int i, int j)
+    {
+        return storage.data()[m / lanes * groupSize + (size_t(i) * N + j) * lanes + m % lanes];
+    }
+
+    T operator()(size_t m, int i, int j) const
+    {
+        return storage.data()[m / lanes * groupSize + (size_t(i) * N + j) * lanes + m % lanes];
+    }
+
+    FixedMatrix<T, N> get(size_t m) const
+    {
+        FixedMatrix<T, N> result;
+        for (int i = 0; i < N; ++i)
+        {
+            for (int j = 0; j < N; ++j)
+            {
+                result.data[i][j] = (*this)(m, i, j);
+            }
+        }
+        return result;
+    }
+
+    void set(size_t m, const FixedMatrix<T, N>& value)
+    {
+        for (int i = 0; i < N; ++i)
+        {
+            for (int j = 0; j < N; ++j)
+            {
+                (*this)(m, i, j) = value.data[i][j];
+            }
+        }
+    }
+
+    T* group(size_t g)
+    {
+        return storage.data() + g * groupSize;
+    }
+
+    const T* group(size_t g) const
+    {
+        return storage.data() + g * groupSize;
+    }
+private:
+    static size_t groupsOf(size_t count)
+    {
+        return (count + lanes - 1) / lanes;
+    }
+
+    size_t count;
+    AlignedBuffer<T> storage;
+};
+
+// c = a*b for groups consecutive groups, c must not overlap a or b
+template<class T, int N>
+struct BatchKernel
+{
+    typedef void (*Run)(const T* a, const T* b, T* c, size_t groups);
+};
+
+// Row i of the products of a group is built in acc, kept in registers
+// for small N: for every k, the line holding a(i, k) of all lanes times
+// row k of b. The j loop is unrolled, the lane loop is one or two
+// vectors. Stamped once per ISA like the GEMM microkernels.
+#define FIXED_DEFINE_BATCH_KERNEL(Name, TARGET)                               \
+template<class T, int N>                                                      \
+TARGET void Name(const T* __restrict a, const T* __restrict b,                \
+                 T* __restrict c, size_t groups)                              \
+{                                                                             \
+    const int lanes = MatrixBatch<T, N>::lanes;                               \
+    const size_t groupSize = MatrixBatch<T, N>::groupSize;                    \
+    for (size_t g = 0; g < groups; ++g, a += groupSize, b += groupSize,       \
+                                       c += groupSize)                        \
+    {                                                                         \
+        for (int i = 0; i < N; ++i)                                           \
+        {                                                                     \
+            T acc[N * lanes] = {};                                            \
+            for (int k = 0; k < N; ++k)                                       \
+            {                                                                 \
+                const T* x = a + (i*N + k) * lanes;                           \
+                const T* y = b + k*N * lanes;                                 \
+                FIXED_UNROLL                                                  \
+                for (int j = 0; j < N; ++j)                                   \
+                {                                                             \
+                    for (int l = 0; l < lanes; ++l)                           \
+                    {                                                         \
+                        acc[j*lanes + l] += x[l] * y[j*lanes + l];            \
+                    }                                                         \
+                }                                                             \
+            }                                                                 \
+            std::copy(acc, acc + N * lanes, c + i*N * lanes);                 \
+        }                                                                     \
+    }                                                                         \
+}
+
+FIXED_DEFINE_BATCH_KERNEL(batchKernelPortable, )
+#ifdef GEMM_KERNELS_X86
+FIXED_DEFINE_BATCH_KERNEL(batchKernelAvx2, GEMM_AVX2)
+FIXED_DEFINE_BATCH_KERNEL(batchKernelAvx512, GEMM_AVX512)
+#endif
+
+#undef FIXED_DEFINE_BATCH_KERNEL
+
+template<class T, int N>
+typename BatchKernel<T, N>::Run selectBatchKernel()
+{
+#ifdef GEMM_KERNELS_X86
+    switch (gemmIsa())
+    {
+    case GemmIsa::AVX512:
+        return batchKernelAvx512<T, N>;
+    case GemmIsa::AVX2:
+        return batchKernelAvx2<T, N>;
+    default:
+        break;
+    }
+#endif
+    return batchKernelPortable<T, N>;
+}
+
+// the widest kernel this CPU runs for T and N
+template<class T, int N>
+typename BatchKernel<T, N>::Run batchKernel()
+{
+    static const typename BatchKernel<T, N>::Run kernel = selectBatchKernel<T, N>();
+    return kernel;
+}
+
+template<class T, int N>
+void checkBatchSizes(const MatrixBatch<T, N>& a, const MatrixBatch<T, N>& b, const MatrixBatch<T, N>& c)
+{
+    if (a.size() != b.size() || a.size() != c.size())
+    {
+        throw std::invalid_argument("matrix batches differ in size");
+    }
+}
+
+// c[m] = a[m]*b[m] for every m on the calling thread; c is a separate batch
+template<class T, int N>
+void multiplyBatch(const MatrixBatch<T, N>& a, const MatrixBatch<T, N>& b, MatrixBatch<T, N>& c)
+{
+    checkBatchSizes(a, b, c);
+    batchKernel<T, N>()(a.group(0), b.group(0), c.group(0), a.groups());
+}
+
+// same, the groups split over the pool
+template<class T, int N>
+void multiplyBatch(ThreadPool& pool, const MatrixBatch<T, N>& a, const MatrixBatch<T, N>& b,
+                   MatrixBatch<T, N>& c)
+{
+    checkBatchSizes(a, b, c);
+    typename BatchKernel<T, N>::Run kernel = batchKernel<T, N>();
+    pool.parallel_range(size_t(0), a.groups(), size_t(0), [&](size_t first, size_t last) {
+        kernel(a.group(first), b.group(first), c.group(first), last - first);
+    });
+}
+
+#endif
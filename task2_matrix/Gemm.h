@@ -0,0 +1,178 @@
+#ifndef GEMM_H
+#define GEMM_H
+
+#include <algorithm>
+#include <unistd.h>
+
+#include "MatrixView.h"
+#include "GemmKernels.h"
+
+// Blocked, packed GEMM in the GotoBLAS / BLIS layout:
+//
+//   for jc in steps of nc          B panel  kc x nc  -> half of L3
+//     for pc in steps of kc          (packed once, reused by every ic)
+//       for ic in steps of mc      A block  mc x kc  -> half of L2
+//         for jr in steps of nr    B sliver kc x nr  -> half of L1
+//           for ir in steps of mr  microkernel on one mr x nr tile of C
+//
+// Packing copies each block of A and panel of B into the order the
+// microkernel reads them, so its loads are unit stride whatever the
+// strides of the operands are, and zero pads the ragged edges so the
+// kernel always works on whole tiles.
+
+struct GemmBlocking
+{
+    int mc;
+    int kc;
+    int nc;
+};
+
+inline size_t cacheBytes(int name, size_t fallback)
+{
+    long bytes = sysconf(name);
+    return bytes > 0 ? static_cast<size_t>(bytes) : fallback;
+}
+
+template<class T>
+GemmBlocking gemmBlocking(const GemmKernel<T>& kernel)
+{
+#ifdef _SC_LEVEL1_DCACHE_SIZE
+    size_t l1 = cacheBytes(_SC_LEVEL1_DCACHE_SIZE, size_t(32) << 10);
+    size_t l2 = cacheBytes(_SC_LEVEL2_CACHE_SIZE, size_t(256) << 10);
+    size_t l3 = cacheBytes(_SC_LEVEL3_CACHE_SIZE, size_t(8) << 20);
+#else
+    size_t l1 = size_t(32) << 10, l2 = size_t(256) << 10, l3 = size_t(8) << 20;
+#endif
+    GemmBlocking blocking;
+    blocking.kc = std::max<int>(16, l1/2 / (kernel.nr * sizeof(T)));
+    blocking.mc = std::max<int>(1, l2/2 / (blocking.kc * sizeof(T)) / kernel.mr) * kernel.mr;
+    blocking.nc = std::max<int>(1, l3/2 / (blocking.kc * sizeof(T)) / kernel.nr) * kernel.nr;
+    return blocking;
+}
+
+// a block of A as slivers of mr rows, each stored column by column
+template<class T>
+void packA(MatrixView<const T> a, int mr, T* out)
+{
+    for (int ir = 0; ir < a.rows; ir += mr)
+    {
+        int rows = std::min(mr, a.rows - ir);
+        for (int p = 0; p < a.cols; ++p)
+        {
+            for (int i = 0; i < rows; ++i)
+            {
+                out[i] = a(ir + i, p);
+            }
+            std::fill(out + rows, out + mr, T());
+            out += mr;
+        }
+    }
+}
+
+// a panel of B as slivers of nr columns, each stored row by row
+template<class T>
+void packB(MatrixView<const T> b, int nr, T* out)
+{
+    for (int jr = 0; jr < b.cols; jr += nr)
+    {
+        int cols = std::min(nr, b.cols - jr);
+        for (int p = 0; p < b.rows; ++p)
+        {
+            const T* source = b.row(p) + jr;
+            std::copy(source, source + cols, out);
+            std::fill(out + cols, out + nr, T());
+            out += nr;
+        }
+    }
+}
+
+// multiplies one packed block of A by one packed panel of B into c
+template<class T>
+void gemmMacroKernel(const GemmKernel<T>& kernel, int kc, const T* a, const T* b, MatrixView<T> c)
+{
+    for (int jr = 0; jr < c.cols; jr += kernel.nr)
+    {
+        for (int ir = 0; ir < c.rows; ir += kernel.mr)
+        {
+            kernel.run(kc, a + ir*kc, b + jr*kc, c.row(ir) + jr, c.stride,
+                       std::min(kernel.mr, c.rows - ir), std::min(kernel.nr, c.cols - jr));
+        }
+    }
+}
+
+// the blocking of gemmBlocking() clipped to an m x k by k x n product
+template<class T>
+GemmBlocking gemmPanels(int m, int k, int n)
+{
+    GemmKernel<T> kernel = gemmKernel<T>();
+    static const GemmBlocking blocking = gemmBlocking(kernel);
+    GemmBlocking panels;
+    panels.mc = std::min(blocking.mc, (m + kernel.mr - 1) / kernel.mr * kernel.mr);
+    panels.kc = std::min(blocking.kc, k);
+    panels.nc = std::min(blocking.nc, (n + kernel.nr - 1) / kernel.nr * kernel.nr);
+    return panels;
+}
+
+// scratch elements gemm() takes for its packing buffers
+template<class T>
+size_t gemmWorkspaceSize(int m, int k, int n)
+{
+    GemmBlocking panels = gemmPanels<T>(m, k, n);
+    return Workspace<T>::rounded(size_t(panels.mc) * panels.kc) +
+           Workspace<T>::rounded(size_t(panels.kc) * panels.nc);
+}
+
+// c = a*b, or c += a*b if accumulate is set; a is m x k, b is k x n and
+// c is m x n, all three may be views into larger matrices. The packing
+// buffers come out of workspace, which needs gemmWorkspaceSize(m, k, n)
+// elements.
+template<class T>
+void gemm(MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c, Workspace<T> workspace,
+          bool accumulate = false)
+{
+    if (!accumulate)
+    {
+        for (int i = 0; i < c.rows; ++i)
+        {
+            std::fill(c.row(i), c.row(i) + c.cols, T());
+        }
+    }
+    int m = a.rows, k = a.cols, n = b.cols;
+    if (m == 0 || n == 0 || k == 0)
+    {
+        return;
+    }
+
+    GemmKernel<T> kernel = gemmKernel<T>();
+    GemmBlocking panels = gemmPanels<T>(m, k, n);
+    int mc = panels.mc, kc = panels.kc, nc = panels.nc;
+    T* packedA = workspace.take(size_t(mc) * kc);
+    T* packedB = workspace.take(size_t(kc) * nc);
+
+    for (int jc = 0; jc < n; jc += nc)
+    {
+        int nb = std::min(nc, n - jc);
+        for (int pc = 0; pc < k; pc += kc)
+        {
+            int kb = std::min(kc, k - pc);
+            packB(b.block(pc, pc + kb, jc, jc + nb), kernel.nr, packedB);
+            for (int ic = 0; ic < m; ic += mc)
+            {
+                int mb = std::min(mc, m - ic);
+                packA(a.block(ic, ic + mb, pc, pc + kb), kernel.mr, packedA);
+                gemmMacroKernel(kernel, kb, packedA, packedB, c.block(ic, ic + mb, jc, jc + nb));
+            }
+        }
+    }
+}
+
+// same, with packing buffers of its own
+template<class T>
+void gemm(MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c, bool accumulate = false)
+{
+    size_t size = gemmWorkspaceSize<T>(a.rows, a.cols, b.cols);
+    AlignedBuffer<T> buffer(size);
+    gemm(a, b, c, Workspace<T>(buffer.data(), size), accumulate);
+}
+
+#endif
@@ -0,0 +1,283 @@
+#ifndef GEMM_KERNELS_H
+#define GEMM_KERNELS_H
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+// Register-tiled GEMM microkernels. A microkernel multiplies one packed
+// sliver of A (kc columns of mr values) by one packed sliver of B (kc rows
+// of nr values) and adds the mr x nr product to a tile of C. The whole
+// tile lives in vector registers for the length of the k loop: every
+// step is one B row load, then a broadcast of each A value and a
+// multiply-add into the accumulators of its row, so C is read and written
+// once per sliver.
+//
+// float, double and int get 6 x (2 vectors) tiles for AVX2 (with FMA) or
+// AVX-512, whichever the CPU supports; other types, CPUs and compilers get
+// a portable 4 x 4 kernel.
+
+enum class GemmIsa { Scalar, AVX2, AVX512 };
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define GEMM_KERNELS_X86 1
+#include <immintrin.h>
+#endif
+
+inline GemmIsa detectGemmIsa()
+{
+#ifdef GEMM_KERNELS_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f"))
+    {
+        return GemmIsa::AVX512;
+    }
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+    {
+        return GemmIsa::AVX2;
+    }
+#endif
+    return GemmIsa::Scalar;
+}
+
+inline GemmIsa gemmIsa()
+{
+    static const GemmIsa isa = detectGemmIsa();
+    return isa;
+}
+
+inline const char* gemmIsaName(GemmIsa isa)
+{
+    switch (isa)
+    {
+    case GemmIsa::AVX2: return "avx2";
+    case GemmIsa::AVX512: return "avx512";
+    default: return "scalar";
+    }
+}
+
+// c[i*ldc + j] += sum over p of a[p*mr + i] * b[p*nr + j], for the top
+// left rows x cols of the tile (the packed slivers are zero padded)
+template<class T>
+struct GemmKernel
+{
+    typedef void (*Run)(int kc, const T* a, const T* b, T* c, int ldc, int rows, int cols);
+    int mr;
+    int nr;
+    Run run;
+};
+
+const int gemmScalarTile = 4;
+
+template<class T>
+void scalarMicroKernel(int kc, const T* a, const T* b, T* c, int ldc, int rows, int cols)
+{
+    const int tile = gemmScalarTile;
+    T acc[tile][tile] = {};
+    for (int p = 0; p < kc; ++p, a += tile, b += tile)
+    {
+        for (int i = 0; i < tile; ++i)
+        {
+            for (int j = 0; j < tile; ++j)
+            {
+                acc[i][j] += a[i] * b[j];
+            }
+        }
+    }
+    for (int i = 0; i < rows; ++i)
+    {
+        for (int j = 0; j < cols; ++j)
+        {
+            c[i*ldc + j] += acc[i][j];
+        }
+    }
+}
+
+template<class T> struct HasSimdGemm : std::false_type {};
+
+#ifdef GEMM_KERNELS_X86
+
+template<> struct HasSimdGemm<double> : std::true_type {};
+template<> struct HasSimdGemm<float> : std::true_type {};
+template<> struct HasSimdGemm<int32_t> : std::true_type {};
+
+// rows of the SIMD tiles: 6 x 2 accumulators, 2 B vectors and the
+// broadcast fit in the 16 AVX2 registers
+const int gemmSimdMr = 6;
+
+// Per ISA and element type: Vec, lanes, loadu/storeu/set1/zero/add,
+// madd(a, b, c) = c + a*b
+template<class T> struct Avx2GemmOps;
+template<class T> struct Avx512GemmOps;
+
+#define GEMM_AVX2 __attribute__((target("avx2,fma")))
+#define GEMM_AVX512 __attribute__((target("avx512f")))
+
+template<> struct Avx2GemmOps<double>
+{
+    typedef __m256d Vec;
+    static const int lanes = 4;
+    GEMM_AVX2 static Vec loadu(const double* p) { return _mm256_loadu_pd(p); }
+    GEMM_AVX2 static void storeu(double* p, Vec x) { _mm256_storeu_pd(p, x); }
+    GEMM_AVX2 static Vec set1(double v) { return _mm256_set1_pd(v); }
+    GEMM_AVX2 static Vec zero() { return _mm256_setzero_pd(); }
+    GEMM_AVX2 static Vec add(Vec a, Vec b) { return _mm256_add_pd(a, b); }
+    GEMM_AVX2 static Vec madd(Vec a, Vec b, Vec c) { return _mm256_fmadd_pd(a, b, c); }
+};
+
+template<> struct Avx2GemmOps<float>
+{
+    typedef __m256 Vec;
+    static const int lanes = 8;
+    GEMM_AVX2 static Vec loadu(const float* p) { return _mm256_loadu_ps(p); }
+    GEMM_AVX2 static void storeu(float* p, Vec x) { _mm256_storeu_ps(p, x); }
+    GEMM_AVX2 static Vec set1(float v) { return _mm256_set1_ps(v); }
+    GEMM_AVX2 static Vec zero() { return _mm256_setzero_ps(); }
+    GEMM_AVX2 static Vec add(Vec a, Vec b) { return _mm256_add_ps(a, b); }
+    GEMM_AVX2 static Vec madd(Vec a, Vec b, Vec c) { return _mm256_fmadd_ps(a, b, c); }
+};
+
+template<> struct Avx2GemmOps<int32_t>
+{
+    typedef __m256i Vec;
+    static const int lanes = 8;
+    GEMM_AVX2 static Vec loadu(const int32_t* p) { return _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)); }
+    GEMM_AVX2 static void storeu(int32_t* p, Vec x) { _mm256_storeu_si256(reinterpret_cast<__m256i*>(p), x); }
+    GEMM_AVX2 static Vec set1(int32_t v) { return _mm256_set1_epi32(v); }
+    GEMM_AVX2 static Vec zero() { return _mm256_setzero_si256(); }
+    GEMM_AVX2 static Vec add(Vec a, Vec b) { return _mm256_add_epi32(a, b); }
+    GEMM_AVX2 static Vec madd(Vec a, Vec b, Vec c) { return _mm256_add_epi32(c, _mm256_mullo_epi32(a, b)); }
+};
+
+template<> struct Avx512GemmOps<double>
+{
+    typedef __m512d Vec;
+    static const int lanes = 8;
+    GEMM_AVX512 static Vec loadu(const double* p) { return _mm512_loadu_pd(p); }
+    GEMM_AVX512 static void storeu(double* p, Vec x) { _mm512_storeu_pd(p, x); }
+    GEMM_AVX512 static Vec set1(double v) { return _mm512_set1_pd(v); }
+    GEMM_AVX512 static Vec zero() { return _mm512_setzero_pd(); }
+    GEMM_AVX512 static Vec add(Vec a, Vec b) { return _mm512_add_pd(a, b); }
+    GEMM_AVX512 static Vec madd(Vec a, Vec b, Vec c) { return _mm512_fmadd_pd(a, b, c); }
+};
+
+template<> struct Avx512GemmOps<float>
+{
+    typedef __m512 Vec;
+    static const int lanes = 16;
+    GEMM_AVX512 static Vec loadu(const float* p) { return _mm512_loadu_ps(p); }
+    GEMM_AVX512 static void storeu(float* p, Vec x) { _mm512_storeu_ps(p, x); }
+    GEMM_AVX512 static Vec set1(float v) { return _mm512_set1_ps(v); }
+    GEMM_AVX512 static Vec zero() { return _mm512_setzero_ps(); }
+    GEMM_AVX512 static Vec add(Vec a, Vec b) { return _mm512_add_ps(a, b); }
+    GEMM_AVX512 static Vec madd(Vec a, Vec b, Vec c) { return _mm512_fmadd_ps(a, b, c); }
+};
+
+template<> struct Avx512GemmOps<int32_t>
+{
+    typedef __m512i Vec;
+    static const int lanes = 16;
+    GEMM_AVX512 static Vec loadu(const int32_t* p) { return _mm512_loadu_si512(p); }
+    GEMM_AVX512 static void storeu(int32_t* p, Vec x) { _mm512_storeu_si512(p, x); }
+    GEMM_AVX512 static Vec set1(int32_t v) { return _mm512_set1_epi32(v); }
+    GEMM_AVX512 static Vec zero() { return _mm512_setzero_si512(); }
+    GEMM_AVX512 static Vec add(Vec a, Vec b) { return _mm512_add_epi32(a, b); }
+    GEMM_AVX512 static Vec madd(Vec a, Vec b, Vec c) { return _mm512_add_epi32(c, _mm512_mullo_epi32(a, b)); }
+};
+
+// The kernel is the same for every ISA, but a function can only be
+// compiled for one target, so it is stamped out once per ISA. The twelve
+// accumulators are spelled out so they are sure to stay in registers.
+#define GEMM_ROW(r)                                                           \
+    x = V::set1(a[r]);                                                        \
+    c##r##0 = V::madd(x, b0, c##r##0);                                        \
+    c##r##1 = V::madd(x, b1, c##r##1);
+
+#define GEMM_DEFINE_KERNEL(Ops, TARGET)                                       \
+template<class T>                                                             \
+TARGET void microKernel##Ops(int kc, const T* a, const T* b, T* c, int ldc,   \
+                             int rows, int cols)                              \
+{                                                                             \
+    typedef Ops<T> V;                                                         \
+    typedef typename V::Vec Vec;                                              \
+    const int nr = 2*V::lanes;                                                \
+    Vec c00 = V::zero(), c01 = c00, c10 = c00, c11 = c00, c20 = c00,          \
+        c21 = c00, c30 = c00, c31 = c00, c40 = c00, c41 = c00, c50 = c00,     \
+        c51 = c00;                                                            \
+    for (int p = 0; p < kc; ++p, a += gemmSimdMr, b += nr)                    \
+    {                                                                         \
+        Vec b0 = V::loadu(b);                                                 \
+        Vec b1 = V::loadu(b + V::lanes);                                      \
+        Vec x;                                                                \
+        GEMM_ROW(0) GEMM_ROW(1) GEMM_ROW(2)                                   \
+        GEMM_ROW(3) GEMM_ROW(4) GEMM_ROW(5)                                   \
+    }                                                                         \
+    Vec tile[gemmSimdMr][2] = { {c00, c01}, {c10, c11}, {c20, c21},           \
+                                {c30, c31}, {c40, c41}, {c50, c51} };         \
+    for (int i = 0; i < rows; ++i)                                            \
+    {                                                                         \
+        T* target = c + i*ldc;                                                \
+        if (cols == nr)                                                       \
+        {                                                                     \
+            V::storeu(target, V::add(V::loadu(target), tile[i][0]));          \
+            V::storeu(target + V::lanes,                                      \
+                      V::add(V::loadu(target + V::lanes), tile[i][1]));       \
+            continue;                                                         \
+        }                                                                     \
+        T values[nr];                                                         \
+        V::storeu(values, tile[i][0]);                                        \
+        V::storeu(values + V::lanes, tile[i][1]);                             \
+        for (int j = 0; j < cols; ++j)                                        \
+        {                                                                     \
+            target[j] += values[j];                                           \
+        }                                                                     \
+    }                                                                         \
+}
+
+GEMM_DEFINE_KERNEL(Avx2GemmOps, GEMM_AVX2)
+GEMM_DEFINE_KERNEL(Avx512GemmOps, GEMM_AVX512)
+
+#undef GEMM_DEFINE_KERNEL
+#undef GEMM_ROW
+
+#endif
+
+template<class T>
+GemmKernel<T> selectGemmKernel(std::false_type)
+{
+    GemmKernel<T> kernel = { gemmScalarTile, gemmScalarTile, scalarMicroKernel<T> };
+    return kernel;
+}
+
+template<class T>
+GemmKernel<T> selectGemmKernel(std::true_type)
+{
+#ifdef GEMM_KERNELS_X86
+    switch (gemmIsa())
+    {
+    case GemmIsa::AVX512:
+    {
+        GemmKernel<T> kernel = { gemmSimdMr, 2*Avx512GemmOps<T>::lanes, microKernelAvx512GemmOps<T> };
+        return kernel;
+    }
+    case GemmIsa::AVX2:
+    {
+        GemmKernel<T> kernel = { gemmSimdMr, 2*Avx2GemmOps<T>::lanes, microKernelAvx2GemmOps<T> };
+        return kernel;
+    }
+    default:
+        break;
+    }
+#endif
+    return selectGemmKernel<T>(std::false_type());
+}
+
+// the widest microkernel this CPU runs for T
+template<class T>
+GemmKernel<T> gemmKernel()
+{
+    static const GemmKernel<T> kernel = selectGemmKernel<T>(HasSimdGemm<T>());
+    return kernel;
+}
+
+#endif
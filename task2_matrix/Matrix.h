@@ -0,0 +1,340 @@
+#ifndef MATRIX_H
+#define MATRIX_H
+
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <type_traits>
+#include <cstdlib>
+#include <stdexcept>
+
+#include "MatrixView.h"
+#include "MatrixExpr.h"
+#include "Gemm.h"
+
+// Dense rows x cols matrix in one aligned row-major buffer. The stride is
+// cols rounded up to a whole number of cache lines, so every row starts
+// aligned.
+template<class T>
+class Matrix
+{
+public:
+    explicit Matrix(int n)
+        :Matrix(n, n)
+    {
+    }
+
+    Matrix(int rows, int cols)
+        : rows(rows), cols(cols), stride(paddedStride(cols)),
+          data(static_cast<T*>(alignedAllocate(size_t(rows) * stride * sizeof(T))))
+    {
+    }
+
+    ~Matrix()
+    {
+        std::free(data);
+    }
+
+    Matrix(Matrix const& m)
+        :Matrix(m.rows, m.cols)
+    {
+        copyPart(m, 0, rows, 0, cols);
+    }
+
+    explicit Matrix(MatrixView<const T> m)
+        :Matrix(m.rows, m.cols)
+    {
+        copyPart(m, 0, rows, 0, cols);
+    }
+
+    Matrix(Matrix const& m, int rowStart, int rowEnd, int colStart, int colEnd)
+        :Matrix(m.view(rowStart, rowEnd, colStart, colEnd))
+    {
+    }
+
+    // Matrix<T> P = A + B - C evaluates the expression straight into P
+    template<class E>
+    Matrix(MatrixExpr<E> const& e)
+        :Matrix(e.rows(), e.cols())
+    {
+        evaluate(e, view());
+    }
+
+    Matrix(Matrix && m) noexcept
+        : rows(m.rows), cols(m.cols), stride(m.stride), data(m.data)
+    {
+        m.rows = m.cols = 0;
+        m.data = nullptr;
+    }
+
+    // copies m into rows [rowStart, rowEnd) and columns [colStart, colEnd)
+    void copyPart(MatrixView<const T> m, int rowStart, int rowEnd, int colStart, int colEnd)
+    {
+        for (int i = rowStart; i < rowEnd; ++i)
+        {
+            const T* source = m.row(i-rowStart);
+            std::copy(source, source + (colEnd - colStart), row(i) + colStart);
+        }
+    }
+
+    template<class E>
+    void copyPart(MatrixExpr<E> const& e, int rowStart, int rowEnd, int colStart, int colEnd)
+    {
+        evaluate(e, view(rowStart, rowEnd, colStart, colEnd));
+    }
+
+    Matrix& operator = (Matrix const& m)
+    {
+        if (this != &m)
+        {
+            if (rows != m.rows || cols != m.cols)
+            {
+                *this = Matrix(m);
+            }
+            else
+            {
+                copyPart(m, 0, rows, 0, cols);
+            }
+        }
+        return *this;
+    }
+
+    template<class E>
+    Matrix& operator=(MatrixExpr<E> const& e)
+    {
+        if (rows != e.rows() || cols != e.cols())
+        {
+            *this = Matrix(e);
+        }
+        else
+        {
+            evaluate(e, view());
+        }
+        return *this;
+    }
+
+    Matrix& operator=(Matrix && m) noexcept
+    {
+        if (this != &m)
+        {
+            std::free(data);
+            rows = m.rows;
+            cols = m.cols;
+            stride = m.stride;
+            data = m.data;
+            m.rows = m.cols = 0;
+            m.data = nullptr;
+        }
+        return *this;
+    }
+
+    T& operator()(int i, int j)
+    {
+        return data[size_t(i)*stride + j];
+    }
+
+    T operator()(int i, int j) const
+    {
+        return data[size_t(i)*stride + j];
+    }
+
+    T* row(int i)
+    {
+        return data + size_t(i)*stride;
+    }
+
+    const T* row(int i) const
+    {
+        return data + size_t(i)*stride;
+    }
+
+    MatrixView<T> view()
+    {
+        return MatrixView<T>(data, rows, cols, stride);
+    }
+
+    MatrixView<const T> view() const
+    {
+        return MatrixView<const T>(data, rows, cols, stride);
+    }
+
+    MatrixView<T> view(int rowStart, int rowEnd, int colStart, int colEnd)
+    {
+        return view().block(rowStart, rowEnd, colStart, colEnd);
+    }
+
+    MatrixView<const T> view(int rowStart, int rowEnd, int colStart, int colEnd) const
+    {
+        return view().block(rowStart, rowEnd, colStart, colEnd);
+    }
+
+    operator MatrixView<const T>() const
+    {
+        return view();
+    }
+
+    // x is a matrix, a view or an expression
+    template<class X>
+    Matrix& operator+=(X const& x)
+    {
+        assign(view(), *this + x);
+        return *this;
+    }
+
+    template<class X>
+    Matrix& operator-=(X const& x)
+    {
+        assign(view(), *this - x);
+        return *this;
+    }
+
+    friend std::ostream& operator<< (std::ostream& stream, const Matrix& matrix)
+    {
+        for (int i = 0; i < matrix.rows; i++)
+        {
+            for (int j = 0; j < matrix.cols; j++)
+            {
+                stream << std::setw(3) << matrix(i, j);
+            }
+            stream << std::endl;
+        }
+        return stream;
+    }
+public:
+    int rows;
+    int cols;
+private:
+    static int paddedStride(int cols)
+    {
+        const int perLine = matrixAlignment / sizeof(T);
+        return (cols + perLine - 1) / perLine * perLine;
+    }
+
+    int stride;
+    T* data;
+};
+
+
+// Element type of the things the operators accept: matrices, views and
+// expressions. Anything else has no Element, which takes the operators out
+// of overload resolution.
+template<class X> struct MatrixTraits {};
+template<class T> struct MatrixTraits< Matrix<T> > { typedef T Element; };
+template<class T> struct MatrixTraits< MatrixView<T> > { typedef typename std::remove_const<T>::type Element; };
+template<class E> struct MatrixTraits< MatrixExpr<E> > { typedef typename E::Element Element; };
+
+template<class T>
+MatrixView<const T> constView(const Matrix<T>& m)
+{
+    return m.view();
+}
+
+template<class T>
+MatrixView<const T> constView(MatrixView<T> m)
+{
+    return m;
+}
+
+// every operand as a node of MatrixExpr.h
+template<class T>
+LeafNode<T> exprNode(const Matrix<T>& m)
+{
+    return LeafNode<T>(m.view());
+}
+
+template<class T>
+LeafNode<typename std::remove_const<T>::type> exprNode(MatrixView<T> m)
+{
+    return LeafNode<typename std::remove_const<T>::type>(m);
+}
+
+template<class E>
+E exprNode(const MatrixExpr<E>& e)
+{
+    return e.node;
+}
+
+template<class X>
+using NodeOf = decltype(exprNode(std::declval<const X&>()));
+
+template<class L, class R, class Op>
+using BinaryExpr = MatrixExpr< BinaryNode<NodeOf<L>, NodeOf<R>, Op> >;
+
+// target = source for views, e.g. to fill one quadrant of a larger matrix;
+// an expression source is evaluated in place
+template<class T, class X>
+void assign(MatrixView<T> target, const X& source)
+{
+    evaluate(MatrixExpr< NodeOf<X> >(exprNode(source)), target);
+}
+
+// + - and scalar * are lazy, see MatrixExpr.h
+
+template<class Op, class L, class R>
+BinaryExpr<L, R, Op> binaryExpr(const L& left, const R& right)
+{
+    BinaryNode<NodeOf<L>, NodeOf<R>, Op> node(exprNode(left), exprNode(right));
+    if (node.left.rows() != node.right.rows() || node.left.cols() != node.right.cols())
+    {
+        throw std::invalid_argument("matrix sizes differ");
+    }
+    return BinaryExpr<L, R, Op>(node);
+}
+
+template<class L, class R, class = typename MatrixTraits<L>::Element,
+         class = typename MatrixTraits<R>::Element>
+BinaryExpr<L, R, AddOp> operator+(const L& left, const R& right)
+{
+    return binaryExpr<AddOp>(left, right);
+}
+
+template<class L, class R, class = typename MatrixTraits<L>::Element,
+         class = typename MatrixTraits<R>::Element>
+BinaryExpr<L, R, SubtractOp> operator-(const L& left, const R& right)
+{
+    return binaryExpr<SubtractOp>(left, right);
+}
+
+template<class X>
+MatrixExpr< ScaleNode< NodeOf<X> > > operator*(typename MatrixTraits<X>::Element scalar, const X& matrix)
+{
+    return MatrixExpr< ScaleNode< NodeOf<X> > >(ScaleNode< NodeOf<X> >(scalar, exprNode(matrix)));
+}
+
+// operand of a product: matrices and views are used where they are,
+// expressions are evaluated into a temporary first
+template<class X>
+struct Materialized
+{
+    typedef typename MatrixTraits<X>::Element T;
+    explicit Materialized(const X& x) : view(constView(x)) {}
+    MatrixView<const T> view;
+};
+
+template<class E>
+struct Materialized< MatrixExpr<E> >
+{
+    typedef typename E::Element T;
+    explicit Materialized(const MatrixExpr<E>& e) : value(e), view(value.view()) {}
+    Matrix<T> value;
+    MatrixView<const T> view;
+};
+
+// blocked GEMM from Gemm.h on the calling thread, see ParallelGemm.h for
+// the parallel one
+template<class L, class R, class T = typename MatrixTraits<L>::Element,
+         class = typename MatrixTraits<R>::Element>
+Matrix<T> operator*(const L& left, const R& right)
+{
+    Materialized<L> a(left);
+    Materialized<R> b(right);
+    if (a.view.cols != b.view.rows)
+    {
+        throw std::invalid_argument("matrix sizes do not match for a product");
+    }
+    Matrix<T> result(a.view.rows, b.view.cols);
+    gemm(a.view, b.view, result.view());
+    return result;
+}
+
+#endif
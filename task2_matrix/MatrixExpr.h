@@ -0,0 +1,149 @@
+#ifndef MATRIX_EXPR_H
+#define MATRIX_EXPR_H
+
+#include "MatrixView.h"
+
+// Lazy element-wise expressions. A + B - 2*C does not compute anything:
+// it builds a tree of nodes, fixed at compile time, whose leaves are views
+// of the operands. evaluate() then walks the destination once, row by
+// row, and every element is computed by the fully inlined tree, so there
+// are no temporaries and each operand is read exactly once. Every node
+// hands out a Row cursor with operator[](j), which keeps the inner loop a
+// plain indexed loop the compiler can vectorize.
+//
+// Leaves only refer to their matrices, so an expression has to be
+// consumed in the statement that builds it; don't keep one in an auto
+// variable past the lifetime of a temporary operand.
+
+#if defined(__GNUC__) && !defined(__clang__)
+// target and operands may be the same matrix, but element j of the target
+// only ever depends on element j of the operands
+#define MATRIX_IVDEP _Pragma("GCC ivdep")
+#else
+#define MATRIX_IVDEP
+#endif
+
+template<class T>
+struct LeafNode
+{
+    typedef T Element;
+
+    struct Row
+    {
+        const T* data;
+        T operator[](int j) const { return data[j]; }
+    };
+
+    explicit LeafNode(MatrixView<const T> view) : view(view) {}
+
+    int rows() const { return view.rows; }
+    int cols() const { return view.cols; }
+    Row row(int i) const
+    {
+        Row row = { view.row(i) };
+        return row;
+    }
+
+    MatrixView<const T> view;
+};
+
+struct AddOp
+{
+    template<class T>
+    static T apply(T a, T b) { return a + b; }
+};
+
+struct SubtractOp
+{
+    template<class T>
+    static T apply(T a, T b) { return a - b; }
+};
+
+template<class L, class R, class Op>
+struct BinaryNode
+{
+    typedef typename L::Element Element;
+
+    struct Row
+    {
+        typename L::Row left;
+        typename R::Row right;
+        Element operator[](int j) const { return Op::apply(left[j], right[j]); }
+    };
+
+    BinaryNode(L left, R right) : left(left), right(right) {}
+
+    int rows() const { return left.rows(); }
+    int cols() const { return left.cols(); }
+    Row row(int i) const
+    {
+        Row row = { left.row(i), right.row(i) };
+        return row;
+    }
+
+    L left;
+    R right;
+};
+
+template<class E>
+struct ScaleNode
+{
+    typedef typename E::Element Element;
+
+    struct Row
+    {
+        Element scalar;
+        typename E::Row inner;
+        Element operator[](int j) const { return scalar * inner[j]; }
+    };
+
+    ScaleNode(Element scalar, E inner) : scalar(scalar), inner(inner) {}
+
+    int rows() const { return inner.rows(); }
+    int cols() const { return inner.cols(); }
+    Row row(int i) const
+    {
+        Row row = { scalar, inner.row(i) };
+        return row;
+    }
+
+    Element scalar;
+    E inner;
+};
+
+// marks a node as a whole expression, the type the Matrix operators take
+// and return
+template<class E>
+class MatrixExpr
+{
+public:
+    typedef typename E::Element Element;
+    typedef typename E::Row Row;
+
+    explicit MatrixExpr(E node) : node(node) {}
+
+    int rows() const { return node.rows(); }
+    int cols() const { return node.cols(); }
+    Row row(int i) const { return node.row(i); }
+
+    E node;
+};
+
+// target = expr in one pass
+template<class E>
+void evaluate(const MatrixExpr<E>& expr, MatrixView<typename E::Element> target)
+{
+    typedef typename E::Element T;
+    for (int i = 0; i < target.rows; i++)
+    {
+        typename E::Row source = expr.row(i);
+        T* out = target.row(i);
+        MATRIX_IVDEP
+        for (int j = 0; j < target.cols; j++)
+        {
+            out[j] = source[j];
+        }
+    }
+}
+
+#endif
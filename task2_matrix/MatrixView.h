@@ -0,0 +1,150 @@
+#ifndef MATRIX_VIEW_H
+#define MATRIX_VIEW_H
+
+#include <cstdlib>
+#include <cstring>
+#include <new>
+
+// every row of a Matrix and every packing buffer starts on this boundary
+// (a cache line, and the widest SIMD load)
+const int matrixAlignment = 64;
+
+// zeroed block aligned to matrixAlignment, released with std::free
+inline void* alignedAllocate(size_t bytes)
+{
+    if (bytes == 0)
+    {
+        return nullptr;
+    }
+    void* block = nullptr;
+    if (posix_memalign(&block, matrixAlignment, bytes) != 0)
+    {
+        throw std::bad_alloc();
+    }
+    std::memset(block, 0, bytes);
+    return block;
+}
+
+// scratch array for packed panels and other temporaries
+template<class T>
+class AlignedBuffer
+{
+public:
+    explicit AlignedBuffer(size_t count)
+        : block(static_cast<T*>(alignedAllocate(count * sizeof(T))))
+    {
+    }
+
+    ~AlignedBuffer()
+    {
+        std::free(block);
+    }
+
+    AlignedBuffer(AlignedBuffer const&) = delete;
+    AlignedBuffer& operator=(AlignedBuffer const&) = delete;
+
+    T* data() const
+    {
+        return block;
+    }
+private:
+    T* block;
+};
+
+// Non-owning window into row-major storage: element (i, j) lives at
+// data[i*stride + j], an offset taken in size_t so large matrices don't
+// overflow int. Views are cheap to copy and to cut into blocks, so
+// quadrants of a Matrix never have to be copied out. MatrixView<const T>
+// is the read-only flavour, any MatrixView<T> converts to it.
+template<class T>
+class MatrixView
+{
+public:
+    MatrixView(T* data, int rows, int cols, int stride)
+        : data(data), rows(rows), cols(cols), stride(stride) {}
+
+    template<class U>
+    MatrixView(const MatrixView<U>& other)
+        : data(other.data), rows(other.rows), cols(other.cols), stride(other.stride) {}
+
+    T& operator()(int i, int j) const
+    {
+        return data[size_t(i)*stride + j];
+    }
+
+    T* row(int i) const
+    {
+        return data + size_t(i)*stride;
+    }
+
+    MatrixView block(int rowStart, int rowEnd, int colStart, int colEnd) const
+    {
+        return MatrixView(data + size_t(rowStart)*stride + colStart, rowEnd - rowStart, colEnd - colStart, stride);
+    }
+public:
+    T* data;
+    int rows;
+    int cols;
+    int stride;
+};
+
+// Bump allocator over scratch memory someone else owns, e.g. an
+// AlignedBuffer. It is passed around by value: a callee takes blocks from
+// its own copy and everything it took is free again once it returns, so
+// nested calls use the memory like a stack. split() carves out a separate
+// workspace for work that runs alongside the caller. Blocks are whole
+// cache lines, so they stay aligned if the memory is.
+template<class T>
+class Workspace
+{
+public:
+    Workspace() : next(nullptr), end(nullptr) {}
+
+    Workspace(T* begin, size_t count) : next(begin), end(begin + count) {}
+
+    // count rounded up to whole cache lines
+    static size_t rounded(size_t count)
+    {
+        const size_t perLine = matrixAlignment / sizeof(T);
+        return (count + perLine - 1) / perLine * perLine;
+    }
+
+    // elements takeMatrix(rows, cols) uses
+    static size_t matrixSize(int rows, int cols)
+    {
+        return size_t(rows) * rounded(cols);
+    }
+
+    T* take(size_t count)
+    {
+        count = rounded(count);
+        if (count > size_t(end - next))
+        {
+            throw std::bad_alloc();
+        }
+        T* block = next;
+        next += count;
+        return block;
+    }
+
+    MatrixView<T> takeMatrix(int rows, int cols)
+    {
+        int stride = static_cast<int>(rounded(cols));
+        return MatrixView<T>(take(size_t(rows) * stride), rows, cols, stride);
+    }
+
+    Workspace split(size_t count)
+    {
+        return Workspace(take(count), rounded(count));
+    }
+
+    size_t remaining() const
+    {
+        return end - next;
+    }
+private:
+    T* next;
+    T* end;
+};
+
+#endif
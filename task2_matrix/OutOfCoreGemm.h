@@ -0,0 +1,288 @@
+#ifndef OUT_OF_CORE_GEMM_H
+#define OUT_OF_CORE_GEMM_H
+
+#include <future>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <functional>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+#include "TiledMatrixFile.h"
+#include "ParallelGemm.h"
+
+// C = A*B for tiled matrix files that need not fit in memory. C is
+// computed one tile at a time, in row-major order of its tile grid:
+// tile (i, j) is the sum over p of A(i, p) * B(p, j), each product a
+// parallel GEMM on the pool. The tiles of A and B go through a
+// TileBufferPool of fixed size. While step s multiplies its pair of
+// tiles, the pair of step s+1 is already being read on another thread,
+// and a finished tile of C is written back behind the next one.
+//
+// Row i of A's tiles is used again for every tile in row i of C, B's
+// tiles only once per row of C. So the buffer pool keeps the current row
+// of A and evicts the tiles of B first: with room for depth + 2 tiles
+// (the row, the tile of B in use and the one read ahead) every tile of A
+// is read once, and each tile of B once per row of C. With less room the
+// row of A does not fit and its tiles are read again for every tile of C.
+// Peak memory is the budget plus two tiles of C, whatever the file sizes.
+
+// default budget for the tiles of A and B
+const size_t outOfCoreMemoryBytes = size_t(256) << 20;
+
+// A fixed number of tile-sized buffers. acquire() hands out the buffer
+// already holding a tile, or starts reading it into the least recently
+// used buffer no one holds, sparing the row set by keepRow() while any
+// other buffer can go. Only the thread driving the multiply calls into
+// the pool, the reads run on threads of their own.
+template<class T>
+class TileBufferPool
+{
+public:
+    // which tile: matrix is a caller-chosen id
+    struct Key
+    {
+        int matrix;
+        int i;
+        int j;
+
+        bool operator==(const Key& other) const
+        {
+            return matrix == other.matrix && i == other.i && j == other.j;
+        }
+    };
+
+    TileBufferPool(size_t tileElements, int count)
+        : tileElements(tileElements), memory(tileElements * count), slots(count), clock(0),
+          keptMatrix(-1), keptRow(-1), tileReads(0)
+    {
+    }
+
+    // tiles (row, *) of matrix are evicted only when nothing else can be
+    void keepRow(int matrix, int row)
+    {
+        keptMatrix = matrix;
+        keptRow = row;
+    }
+
+    // the slot that holds or will hold key; load(buffer) reads the tile
+    // if it isn't resident. The slot is held until release().
+    int acquire(Key key, std::function<void(T*)> load)
+    {
+        int victim = -1;
+        for (int s = 0; s < int(slots.size()); ++s)
+        {
+            Slot& slot = slots[s];
+            if (slot.valid && slot.key == key)
+            {
+                return hold(s);
+            }
+            if (slot.pins == 0 && (victim < 0 || rank(slot) < rank(slots[victim]) ||
+                                   (rank(slot) == rank(slots[victim]) && slot.used < slots[victim].used)))
+            {
+                victim = s;
+            }
+        }
+        if (victim < 0)
+        {
+            throw std::logic_error("every tile buffer is in use");
+        }
+        Slot& slot = slots[victim];
+        T* buffer = data(victim);
+        slot.key = key;
+        slot.valid = true;
+        slot.ready = std::async(std::launch::async, [load, buffer] { load(buffer); }).share();
+        ++tileReads;
+        return hold(victim);
+    }
+
+    // the tile in slot, once its read finished
+    const T* get(int slot)
+    {
+        try
+        {
+            slots[slot].ready.get();
+        }
+        catch (...)
+        {
+            // don't hand out a tile that failed to load again
+            slots[slot].valid = false;
+            throw;
+        }
+        return data(slot);
+    }
+
+    void release(int slot)
+    {
+        --slots[slot].pins;
+    }
+
+    // tiles read into a buffer so far
+    size_t reads() const
+    {
+        return tileReads;
+    }
+private:
+    struct Slot
+    {
+        Key key;
+        bool valid = false;
+        int pins = 0;
+        uint64_t used = 0;
+        std::shared_future<void> ready;
+    };
+
+    // eviction order: free buffers, then other tiles, then the kept row
+    int rank(const Slot& slot) const
+    {
+        if (!slot.valid)
+        {
+            return 0;
+        }
+        return slot.key.matrix == keptMatrix && slot.key.i == keptRow ? 2 : 1;
+    }
+
+    int hold(int slot)
+    {
+        ++slots[slot].pins;
+        slots[slot].used = ++clock;
+        return slot;
+    }
+
+    T* data(int slot)
+    {
+        return memory.data() + size_t(slot) * tileElements;
+    }
+
+    size_t tileElements;
+    AlignedBuffer<T> memory;
+    // declared after memory: destroying a slot waits for its read, which
+    // has to land before the memory goes
+    std::vector<Slot> slots;
+    uint64_t clock;
+    int keptMatrix;
+    int keptRow;
+    size_t tileReads;
+};
+
+// true if path exists and is the file open as fd, opened from fdPath
+inline bool isOpenFile(int fd, const std::string& fdPath, const std::string& path)
+{
+    struct stat file, open;
+    if (stat(path.c_str(), &file) != 0)
+    {
+        return false;
+    }
+    if (fstat(fd, &open) != 0)
+    {
+        throw std::runtime_error("cannot stat " + fdPath + ": " + std::strerror(errno));
+    }
+    return file.st_dev == open.st_dev && file.st_ino == open.st_ino;
+}
+
+// multiplies the files at aPath and bPath, which have to share a tile
+// size, into a new file at cPath with that tile size; returns the number
+// of tiles of A and B read. cPath must not name A or B.
+template<class T>
+size_t outOfCoreMultiply(ThreadPool& pool, const std::string& aPath, const std::string& bPath,
+                       const std::string& cPath, size_t memoryBytes = outOfCoreMemoryBytes)
+{
+    FileHandle aFile(aPath, O_RDONLY);
+    FileHandle bFile(bPath, O_RDONLY);
+    TiledLayout<T> a = readTiledLayout<T>(aFile.get(), aPath);
+    TiledLayout<T> b = readTiledLayout<T>(bFile.get(), bPath);
+    if (a.cols != b.rows || a.tile != b.tile)
+    {
+        throw std::invalid_argument("matrix sizes or tile sizes do not match for a product");
+    }
+    // creating C truncates it, which would wipe an input
+    if (isOpenFile(aFile.get(), aPath, cPath) || isOpenFile(bFile.get(), bPath, cPath))
+    {
+        throw std::invalid_argument(cPath + " is an input of the product");
+    }
+    TiledLayout<T> c = createTiledMatrix<T>(cPath, a.rows, b.cols, a.tile);
+    FileHandle cFile(cPath, O_RDWR);
+    int tile = a.tile, depth = a.tilesAcross();
+    size_t tileElements = a.tileElements();
+
+    // the pair in use and the pair being read ahead
+    int count = std::max<int>(4, memoryBytes / (tileElements * sizeof(T)));
+    TileBufferPool<T> buffers(tileElements, count);
+    AlignedBuffer<T> cTiles(2 * tileElements);
+    std::future<void> written[2];
+
+    struct Step
+    {
+        int i;
+        int j;
+        int p;
+    };
+    long steps = long(c.tilesDown()) * c.tilesAcross() * depth;
+    auto stepOf = [&](long s) {
+        Step step = { int(s / depth / c.tilesAcross()), int(s / depth % c.tilesAcross()), int(s % depth) };
+        return step;
+    };
+    auto request = [&](Step step, int& slotA, int& slotB) {
+        typedef typename TileBufferPool<T>::Key Key;
+        Key keyA = { 0, step.i, step.p }, keyB = { 1, step.p, step.j };
+        buffers.keepRow(0, step.i);
+        slotA = buffers.acquire(keyA, [&aFile, &aPath, a, step](T* out) {
+            readTile(aFile.get(), a, step.i, step.p, out, aPath);
+        });
+        slotB = buffers.acquire(keyB, [&bFile, &bPath, b, step](T* out) {
+            readTile(bFile.get(), b, step.p, step.j, out, bPath);
+        });
+    };
+
+    int slotA = 0, slotB = 0, nextA = 0, nextB = 0;
+    if (steps > 0)
+    {
+        request(stepOf(0), slotA, slotB);
+    }
+    for (long s = 0; s < steps; ++s)
+    {
+        Step step = stepOf(s);
+        if (s + 1 < steps)
+        {
+            request(stepOf(s + 1), nextA, nextB);
+        }
+        // alternate between the two tiles of C, one may still be written
+        int half = (s / depth) % 2;
+        T* cTile = cTiles.data() + half * tileElements;
+        if (step.p == 0)
+        {
+            if (written[half].valid())
+            {
+                written[half].get();
+            }
+            std::fill(cTile, cTile + tileElements, T());
+        }
+
+        int rows = a.tileRows(step.i), inner = a.tileCols(step.p), cols = b.tileCols(step.j);
+        MatrixView<const T> aTile(buffers.get(slotA), rows, inner, tile);
+        MatrixView<const T> bTile(buffers.get(slotB), inner, cols, tile);
+        gemm(pool, aTile, bTile, MatrixView<T>(cTile, rows, cols, tile), true);
+        buffers.release(slotA);
+        buffers.release(slotB);
+
+        if (step.p == depth - 1)
+        {
+            written[half] = std::async(std::launch::async, [&cFile, &cPath, c, step, cTile] {
+                writeTile(cFile.get(), c, step.i, step.j, cTile, cPath);
+            });
+        }
+        slotA = nextA;
+        slotB = nextB;
+    }
+    for (auto& write: written)
+    {
+        if (write.valid())
+        {
+            write.get();
+        }
+    }
+    return buffers.reads();
+}
+
+#endif
@@ -0,0 +1,110 @@
+#ifndef PARALLEL_GEMM_H
+#define PARALLEL_GEMM_H
+
+#include <atomic>
+#include <vector>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+#include "Matrix.h"
+#include "Gemm.h"
+
+// The blocked GEMM of Gemm.h split over a ThreadPool, for the shapes where
+// Strassen loses: rectangular operands, a small k, or integers that have
+// to stay exact.
+//
+// Every kc x nc panel of B is packed once, by all workers together, into
+// a buffer they share. The part of C under that panel is cut into 2D
+// tiles of mc rows and a multiple of nr columns, a few per worker, and
+// the workers claim tiles until none are left. Each keeps a packing
+// buffer for the mc x kc block of A its tile reads, and only packs it
+// again when a tile needs another block. The microkernel sees exactly
+// the tiles the sequential gemm() gives it, so the result is the same
+// bit for bit.
+
+// tiles per worker, so that stealing can even out uneven progress
+const int gemmTilesPerLane = 4;
+
+// c = a*b, or c += a*b if accumulate is set, shapes as for gemm()
+template<class T>
+void gemm(ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c,
+          bool accumulate = false)
+{
+    if (!accumulate)
+    {
+        pool.parallel_for(0, c.rows, 0, [&](int i) {
+            std::fill(c.row(i), c.row(i) + c.cols, T());
+        });
+    }
+    int m = a.rows, k = a.cols, n = b.cols;
+    if (m == 0 || n == 0 || k == 0)
+    {
+        return;
+    }
+
+    GemmKernel<T> kernel = gemmKernel<T>();
+    GemmBlocking panels = gemmPanels<T>(m, k, n);
+    int mc = panels.mc, kc = panels.kc, nc = panels.nc, nr = kernel.nr;
+    int lanes = static_cast<int>(std::max<size_t>(1, pool.size()));
+    size_t blockA = Workspace<T>::rounded(size_t(mc) * kc);
+    size_t panelB = Workspace<T>::rounded(size_t(kc) * nc);
+    AlignedBuffer<T> buffer(panelB + lanes * blockA);
+    T* packedB = buffer.data();
+    // first row of the block of A each lane has packed, -1 for none
+    std::vector<int> packedRow(lanes);
+
+    int rowTiles = (m + mc - 1) / mc;
+    for (int jc = 0; jc < n; jc += nc)
+    {
+        int nb = std::min(nc, n - jc);
+        int slivers = (nb + nr - 1) / nr;
+        int colTiles = std::min(slivers, std::max(1, (gemmTilesPerLane*lanes + rowTiles - 1) / rowTiles));
+        int tileSlivers = (slivers + colTiles - 1) / colTiles;
+        colTiles = (slivers + tileSlivers - 1) / tileSlivers;
+        int tiles = rowTiles * colTiles;
+
+        for (int pc = 0; pc < k; pc += kc)
+        {
+            int kb = std::min(kc, k - pc);
+            pool.parallel_for(0, slivers, 0, [&](int s) {
+                int j = s*nr;
+                packB(b.block(pc, pc + kb, jc + j, jc + std::min(j + nr, nb)), nr, packedB + size_t(j)*kb);
+            });
+
+            std::fill(packedRow.begin(), packedRow.end(), -1);
+            std::atomic<int> next(0);
+            pool.parallel_for(0, lanes, 1, [&](int lane) {
+                T* packedA = buffer.data() + panelB + lane*blockA;
+                for (int t = next++; t < tiles; t = next++)
+                {
+                    int ic = t / colTiles * mc;
+                    int j = t % colTiles * tileSlivers * nr;
+                    int mb = std::min(mc, m - ic);
+                    int jb = std::min(tileSlivers * nr, nb - j);
+                    if (packedRow[lane] != ic)
+                    {
+                        packA(a.block(ic, ic + mb, pc, pc + kb), kernel.mr, packedA);
+                        packedRow[lane] = ic;
+                    }
+                    gemmMacroKernel(kernel, kb, packedA, packedB + size_t(j)*kb,
+                                    c.block(ic, ic + mb, jc + j, jc + j + jb));
+                }
+            });
+        }
+    }
+}
+
+template<class T>
+Matrix<T> gemm(ThreadPool& pool, const Matrix<T>& a, const Matrix<T>& b)
+{
+    if (a.cols != b.rows)
+    {
+        throw std::invalid_argument("matrix sizes do not match for a product");
+    }
+    Matrix<T> result(a.rows, b.cols);
+    gemm(pool, a.view(), b.view(), result.view());
+    return result;
+}
+
+#endif
@@ -0,0 +1,404 @@
+#ifndef STRASSEN_H
+#define STRASSEN_H
+
+#include <future>
+#include <chrono>
+#include <functional>
+#include <algorithm>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+#include "Matrix.h"
+#include "Gemm.h"
+
+/*
+     X           Y                X*Y
+ +-------+   +-------+     +-------+-------+
+ | A | B |   | E | F |     | AE+BG | AF+BH |
+ +---+---+ * +---+---+  =  +-------+-------+
+ | C | D |   | G | H |     | CE+DG | CF+DH |
+ +---+---+   +---+---+     +---------------+
+ Seven products:
+ P1 = A(F-H)
+ P2 = (A+B)H
+ P3 = (C+D)E
+ P4 = D(G-E)
+ P5 = (A+D)(E+H)
+ P6 = (B-D)(G+H)
+ P7 = (A-C)(E+F)
+
+         +-------------+-------------+
+         | P5+P4-P2+P6 |    P1+P2    |
+ X * Y = +-------------+-------------+
+         |    P3+P4    | P1+P5-P3-P7 |
+         +-------------+-------------+
+
+ Every product recurses until the size drops below the threshold, where
+ the blocked GEMM of Gemm.h takes over. On the top parallelDepth levels
+ the seven products are tasks on the pool; the caller runs one of them
+ itself and helps with the rest while it waits. An odd size n is peeled:
+ the leading (n-1) x (n-1) block goes through Strassen, and the last row
+ and column are a rank-1 update and two thin GEMMs.
+
+ Below the parallel levels the products run one after another in
+ Winograd's variant (7 products, 15 additions) with the schedule of
+ Douglas et al., which keeps the products in the quadrants of the result
+ and needs just two scratch quadrants per level:
+
+   X = A-C    Y = H-F    C21 = X*Y          P7 = (A-C)(H-F)
+   X = C+D    Y = F-E    C22 = X*Y          P5 = (C+D)(F-E)
+   X = X-A    Y = H-Y    C12 = X*Y          P6 = (C+D-A)(H-F+E)
+   X = B-X               C11 = X*H          P3 = (A+B-C-D)H
+   X = A*E                                  P1
+   C12 = X+C12    C21 = C12+C21    C12 = C12+C22    C22 = C21+C22
+   C12 = C12+C11
+   Y = Y-G               C11 = D*Y          P4 = D(H-F+E-G)
+   C21 = C21-C11
+   C11 = B*G      C11 = X+C11               P2 = BG
+
+ All scratch, down to the GEMM packing buffers, comes from one Workspace
+ allocated up front with strassenWorkspaceSize() elements, so nothing is
+ allocated on the way down. The sequential levels need about 2/3 n^2 in
+ all; a parallel level needs more, as its seven tasks are in flight
+ together and each gets its product, its operand sums and the scratch of
+ its own recursion.
+*/
+
+struct StrassenOptions
+{
+    // sizes below this go to the blocked GEMM, 0 measures the crossover
+    // once per element type
+    int threshold = 0;
+    // levels whose products run in parallel, -1 for enough of them to
+    // give every worker a couple of products
+    int parallelDepth = -1;
+};
+
+// threshold used when the timing never favours Strassen
+const int strassenMaxThreshold = 2048;
+
+// scratch elements strassenRecursive() takes for n x n operands
+template<class T>
+size_t strassenWorkspaceSize(int n, int threshold, int parallelDepth)
+{
+    if (n < threshold || n < 2)
+    {
+        return gemmWorkspaceSize<T>(n, n, n);
+    }
+    if (n % 2)
+    {
+        int m = n - 1;
+        return std::max({ strassenWorkspaceSize<T>(m, threshold, parallelDepth),
+                          gemmWorkspaceSize<T>(m, 1, m),
+                          gemmWorkspaceSize<T>(n, n, 1),
+                          gemmWorkspaceSize<T>(1, n, m) });
+    }
+    int h = n/2;
+    size_t quadrant = Workspace<T>::matrixSize(h, h);
+    size_t below = strassenWorkspaceSize<T>(h, threshold, parallelDepth - 1);
+    if (parallelDepth > 0)
+    {
+        // the seven products, and for every task two operand sums and
+        // the workspace of its own recursion
+        return 7*quadrant + 7*(2*quadrant + below);
+    }
+    return 2*quadrant + below;
+}
+
+template<class T>
+void strassenRecursive(ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c,
+                       Workspace<T> workspace, int threshold, int parallelDepth);
+
+template<class T>
+void strassenPeel(ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c,
+                  Workspace<T> workspace, int threshold, int parallelDepth)
+{
+    int n = a.rows, m = n - 1;
+    strassenRecursive(pool, a.block(0, m, 0, m), b.block(0, m, 0, m), c.block(0, m, 0, m),
+                      workspace, threshold, parallelDepth);
+    gemm(a.block(0, m, m, n), b.block(m, n, 0, m), c.block(0, m, 0, m), workspace, true);
+    gemm(a, b.block(0, n, m, n), c.block(0, n, m, n), workspace);
+    gemm(a.block(m, n, 0, n), b.block(0, n, 0, m), c.block(m, n, 0, m), workspace);
+}
+
+// an operand of a product: views as they are, sums evaluated into scratch
+template<class T>
+MatrixView<const T> strassenOperand(Workspace<T>&, MatrixView<const T> view)
+{
+    return view;
+}
+
+template<class T, class E>
+MatrixView<const T> strassenOperand(Workspace<T>& workspace, const MatrixExpr<E>& sum)
+{
+    MatrixView<T> value = workspace.takeMatrix(sum.rows(), sum.cols());
+    evaluate(sum, value);
+    return value;
+}
+
+template<class T, class L, class R>
+void strassenProduct(ThreadPool& pool, const L& left, const R& right, MatrixView<T> product,
+                     Workspace<T> workspace, int threshold, int parallelDepth)
+{
+    MatrixView<const T> a = strassenOperand(workspace, left);
+    MatrixView<const T> b = strassenOperand(workspace, right);
+    strassenRecursive(pool, a, b, product, workspace, threshold, parallelDepth);
+}
+
+// the seven products as tasks, see the comment at the top
+template<class T>
+void strassenParallel(ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c,
+                      Workspace<T> workspace, int threshold, int parallelDepth)
+{
+    int n = a.rows, h = n/2;
+    MatrixView<const T> A = a.block(0, h, 0, h);
+    MatrixView<const T> B = a.block(0, h, h, n);
+    MatrixView<const T> C = a.block(h, n, 0, h);
+    MatrixView<const T> D = a.block(h, n, h, n);
+
+    MatrixView<const T> E = b.block(0, h, 0, h);
+    MatrixView<const T> F = b.block(0, h, h, n);
+    MatrixView<const T> G = b.block(h, n, 0, h);
+    MatrixView<const T> H = b.block(h, n, h, n);
+
+    int depth = parallelDepth - 1;
+    size_t slice = 2*Workspace<T>::matrixSize(h, h) + strassenWorkspaceSize<T>(h, threshold, depth);
+    MatrixView<T> P[7] = {
+        workspace.takeMatrix(h, h), workspace.takeMatrix(h, h), workspace.takeMatrix(h, h),
+        workspace.takeMatrix(h, h), workspace.takeMatrix(h, h), workspace.takeMatrix(h, h),
+        workspace.takeMatrix(h, h)
+    };
+    Workspace<T> own[7];
+    for (auto& task: own)
+    {
+        task = workspace.split(slice);
+    }
+    // operand sums are evaluated in one pass into the scratch of the task
+    std::function<void()> products[7] = {
+        [&]{ strassenProduct(pool, A, F-H, P[0], own[0], threshold, depth); },
+        [&]{ strassenProduct(pool, A+B, H, P[1], own[1], threshold, depth); },
+        [&]{ strassenProduct(pool, C+D, E, P[2], own[2], threshold, depth); },
+        [&]{ strassenProduct(pool, D, G-E, P[3], own[3], threshold, depth); },
+        [&]{ strassenProduct(pool, A+D, E+H, P[4], own[4], threshold, depth); },
+        [&]{ strassenProduct(pool, B-D, G+H, P[5], own[5], threshold, depth); },
+        [&]{ strassenProduct(pool, A-C, E+F, P[6], own[6], threshold, depth); }
+    };
+
+    std::future<void> pending[6];
+    for (int i = 1; i < 7; ++i)
+    {
+        pending[i-1] = pool.enqueue(products[i]);
+    }
+    std::exception_ptr error;
+    try
+    {
+        products[0]();
+    }
+    catch (...)
+    {
+        error = std::current_exception();
+    }
+    // every task has to finish before its scratch goes out of scope
+    for (auto& product: pending)
+    {
+        pool.wait(product);
+    }
+    if (error)
+    {
+        std::rethrow_exception(error);
+    }
+    for (auto& product: pending)
+    {
+        product.get();
+    }
+
+    assign(c.block(0, h, 0, h), P[4]+P[3]-P[1]+P[5]);
+    assign(c.block(0, h, h, n), P[0]+P[1]);
+    assign(c.block(h, n, 0, h), P[2]+P[3]);
+    assign(c.block(h, n, h, n), P[0]+P[4]-P[2]-P[6]);
+}
+
+// Winograd's variant in the schedule at the top
+template<class T>
+void strassenWinograd(ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c,
+                      Workspace<T> workspace, int threshold)
+{
+    int n = a.rows, h = n/2;
+    MatrixView<const T> A = a.block(0, h, 0, h);
+    MatrixView<const T> B = a.block(0, h, h, n);
+    MatrixView<const T> C = a.block(h, n, 0, h);
+    MatrixView<const T> D = a.block(h, n, h, n);
+
+    MatrixView<const T> E = b.block(0, h, 0, h);
+    MatrixView<const T> F = b.block(0, h, h, n);
+    MatrixView<const T> G = b.block(h, n, 0, h);
+    MatrixView<const T> H = b.block(h, n, h, n);
+
+    MatrixView<T> C11 = c.block(0, h, 0, h);
+    MatrixView<T> C12 = c.block(0, h, h, n);
+    MatrixView<T> C21 = c.block(h, n, 0, h);
+    MatrixView<T> C22 = c.block(h, n, h, n);
+
+    MatrixView<T> X = workspace.takeMatrix(h, h);
+    MatrixView<T> Y = workspace.takeMatrix(h, h);
+
+    assign(X, A-C);
+    assign(Y, H-F);
+    strassenRecursive<T>(pool, X, Y, C21, workspace, threshold, 0);
+    assign(X, C+D);
+    assign(Y, F-E);
+    strassenRecursive<T>(pool, X, Y, C22, workspace, threshold, 0);
+    assign(X, X-A);
+    assign(Y, H-Y);
+    strassenRecursive<T>(pool, X, Y, C12, workspace, threshold, 0);
+    assign(X, B-X);
+    strassenRecursive<T>(pool, X, H, C11, workspace, threshold, 0);
+    strassenRecursive<T>(pool, A, E, X, workspace, threshold, 0);
+    assign(C12, X+C12);
+    assign(C21, C12+C21);
+    assign(C12, C12+C22);
+    assign(C22, C21+C22);
+    assign(C12, C12+C11);
+    assign(Y, Y-G);
+    strassenRecursive<T>(pool, D, Y, C11, workspace, threshold, 0);
+    assign(C21, C21-C11);
+    strassenRecursive<T>(pool, B, G, C11, workspace, threshold, 0);
+    assign(C11, X+C11);
+}
+
+template<class T>
+void strassenRecursive(ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c,
+                       Workspace<T> workspace, int threshold, int parallelDepth)
+{
+    int n = a.rows;
+    if (n < threshold || n < 2)
+    {
+        gemm(a, b, c, workspace);
+    }
+    else if (n % 2)
+    {
+        strassenPeel(pool, a, b, c, workspace, threshold, parallelDepth);
+    }
+    else if (parallelDepth > 0)
+    {
+        strassenParallel(pool, a, b, c, workspace, threshold, parallelDepth);
+    }
+    else
+    {
+        strassenWinograd(pool, a, b, c, workspace, threshold);
+    }
+}
+
+inline double secondsOf(std::function<void()> run)
+{
+    // best of two, the first run also pays for page faults
+    double best = 0;
+    for (int i = 0; i < 2; ++i)
+    {
+        std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+        run();
+        double seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        best = i == 0 ? seconds : std::min(best, seconds);
+    }
+    return best;
+}
+
+// smallest power of two size at which one Strassen level over GEMM beats
+// GEMM on its own, timed on a single thread
+template<class T>
+int tuneStrassenThreshold(ThreadPool& pool)
+{
+    for (int n = 128; n < strassenMaxThreshold; n *= 2)
+    {
+        Matrix<T> a(n), b(n), c(n);
+        for (int i = 0; i < n; ++i)
+        {
+            for (int j = 0; j < n; ++j)
+            {
+                a(i, j) = T((i + j) % 7);
+                b(i, j) = T((i * j) % 5);
+            }
+        }
+        size_t size = std::max(gemmWorkspaceSize<T>(n, n, n), strassenWorkspaceSize<T>(n, n, 0));
+        AlignedBuffer<T> buffer(size);
+        Workspace<T> workspace(buffer.data(), size);
+        double classical = secondsOf([&]{ gemm<T>(a, b, c.view(), workspace); });
+        double oneLevel = secondsOf([&]{ strassenRecursive<T>(pool, a, b, c.view(), workspace, n, 0); });
+        if (oneLevel < classical)
+        {
+            return n;
+        }
+    }
+    return strassenMaxThreshold;
+}
+
+template<class T>
+int strassenThreshold(ThreadPool& pool)
+{
+    static const int threshold = tuneStrassenThreshold<T>(pool);
+    return threshold;
+}
+
+// options with the defaults worked out for this pool
+template<class T>
+StrassenOptions strassenResolve(ThreadPool& pool, StrassenOptions options)
+{
+    if (options.threshold <= 0)
+    {
+        options.threshold = strassenThreshold<T>(pool);
+    }
+    if (options.parallelDepth < 0)
+    {
+        options.parallelDepth = 0;
+        for (size_t tasks = 1; tasks < 2*pool.size(); tasks *= 7)
+        {
+            ++options.parallelDepth;
+        }
+    }
+    return options;
+}
+
+// scratch elements strassen() needs for n x n operands
+template<class T>
+size_t strassenWorkspaceSize(ThreadPool& pool, int n, StrassenOptions options = StrassenOptions())
+{
+    options = strassenResolve<T>(pool, options);
+    return strassenWorkspaceSize<T>(n, options.threshold, options.parallelDepth);
+}
+
+// c = a*b for square a and b of any size, with scratch from a workspace
+// of at least strassenWorkspaceSize() elements the caller keeps around
+template<class T>
+void strassen(ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c,
+              Workspace<T> workspace, StrassenOptions options = StrassenOptions())
+{
+    int n = a.rows;
+    if (a.cols != n || b.rows != n || b.cols != n || c.rows != n || c.cols != n)
+    {
+        throw std::invalid_argument("strassen needs square matrices of one size");
+    }
+    options = strassenResolve<T>(pool, options);
+    strassenRecursive(pool, a, b, c, workspace, options.threshold, options.parallelDepth);
+}
+
+// same, with a workspace allocated for this call
+template<class T>
+void strassen(ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c,
+              StrassenOptions options = StrassenOptions())
+{
+    options = strassenResolve<T>(pool, options);
+    size_t size = strassenWorkspaceSize<T>(a.rows, options.threshold, options.parallelDepth);
+    AlignedBuffer<T> buffer(size);
+    strassen(pool, a, b, c, Workspace<T>(buffer.data(), size), options);
+}
+
+template<class T>
+Matrix<T> strassen(ThreadPool& pool, const Matrix<T>& a, const Matrix<T>& b,
+                   StrassenOptions options = StrassenOptions())
+{
+    Matrix<T> result(a.rows);
+    strassen(pool, a.view(), b.view(), result.view(), options);
+    return result;
+}
+
+#endif
@@ -0,0 +1,269 @@
+#ifndef TILED_MATRIX_FILE_H
+#define TILED_MATRIX_FILE_H
+
+#include <string>
+#include <cstring>
+#include <cstdint>
+#include <climits>
+#include <cerrno>
+#include <stdexcept>
+#include <algorithm>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#include "StreamScan.h"
+#include "Matrix.h"
+
+// Binary matrix file, stored tile by tile:
+//
+//   offset 0       TiledMatrixHeader, zero padded to tiledMatrixDataOffset
+//   data offset    tiles in row-major order of the tile grid: (0, 0),
+//                  (0, 1), ..., (1, 0), ...
+//
+// Every tile holds tile x tile elements of T, row-major and native endian,
+// zero padded where it hangs over the last row or column. So tile (i, j)
+// sits at a fixed offset, is read or written in one piece and is usable
+// in place as a MatrixView with stride tile. When tile*tile*sizeof(T) is a
+// multiple of the page size, every tile starts on a page of its own.
+
+const char tiledMatrixMagic[8] = { 'T', 'I', 'L', 'E', 'D', 'M', 'A', 'T' };
+const uint32_t tiledMatrixVersion = 1;
+const size_t tiledMatrixDataOffset = 4096;
+
+enum class MatrixDtype : uint32_t { Int32 = 1, Int64 = 2, Float32 = 3, Float64 = 4 };
+
+template<class T> struct DtypeOf;
+template<> struct DtypeOf<int32_t> { static const MatrixDtype value = MatrixDtype::Int32; };
+template<> struct DtypeOf<int64_t> { static const MatrixDtype value = MatrixDtype::Int64; };
+template<> struct DtypeOf<float> { static const MatrixDtype value = MatrixDtype::Float32; };
+template<> struct DtypeOf<double> { static const MatrixDtype value = MatrixDtype::Float64; };
+
+struct TiledMatrixHeader
+{
+    char magic[8];
+    uint32_t version;
+    uint32_t dtype;
+    uint64_t rows;
+    uint64_t cols;
+    uint64_t tile;
+};
+
+// where the tiles of a rows x cols matrix of T are
+template<class T>
+struct TiledLayout
+{
+    int rows;
+    int cols;
+    int tile;
+
+    int tilesDown() const { return (rows + tile - 1) / tile; }
+    int tilesAcross() const { return (cols + tile - 1) / tile; }
+    // rows and columns of tile (i, j) inside the matrix
+    int tileRows(int i) const { return std::min(tile, rows - i*tile); }
+    int tileCols(int j) const { return std::min(tile, cols - j*tile); }
+    size_t tileElements() const { return size_t(tile) * tile; }
+    size_t tileOffset(int i, int j) const
+    {
+        return tiledMatrixDataOffset + (size_t(i) * tilesAcross() + j) * tileElements() * sizeof(T);
+    }
+    size_t fileBytes() const
+    {
+        return tileOffset(tilesDown(), 0);
+    }
+};
+
+inline void readFully(int fd, void* out, size_t bytes, size_t offset, const std::string& path)
+{
+    char* target = static_cast<char*>(out);
+    while (bytes > 0)
+    {
+        ssize_t done = pread(fd, target, bytes, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (done <= 0)
+        {
+            throw std::runtime_error("cannot read " + path + ": " +
+                                     (done == 0 ? std::string("file is truncated") : std::strerror(errno)));
+        }
+        target += done;
+        offset += done;
+        bytes -= done;
+    }
+}
+
+inline void writeFully(int fd, const void* in, size_t bytes, size_t offset, const std::string& path)
+{
+    const char* source = static_cast<const char*>(in);
+    while (bytes > 0)
+    {
+        ssize_t done = pwrite(fd, source, bytes, static_cast<off_t>(offset));
+        if (done < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (done <= 0)
+        {
+            throw std::runtime_error("cannot write " + path + ": " + std::strerror(errno));
+        }
+        source += done;
+        offset += done;
+        bytes -= done;
+    }
+}
+
+// layout from the header of an open file, which has to hold T
+template<class T>
+TiledLayout<T> readTiledLayout(int fd, const std::string& path)
+{
+    TiledMatrixHeader header;
+    readFully(fd, &header, sizeof(header), 0, path);
+    if (std::memcmp(header.magic, tiledMatrixMagic, sizeof(header.magic)) != 0 ||
+        header.version != tiledMatrixVersion)
+    {
+        throw std::runtime_error(path + " is not a tiled matrix file");
+    }
+    if (header.dtype != static_cast<uint32_t>(DtypeOf<T>::value))
+    {
+        throw std::runtime_error(path + " holds another element type");
+    }
+    // sizes and tile indices are int
+    if (header.rows > INT_MAX || header.cols > INT_MAX || header.tile > INT_MAX)
+    {
+        throw std::runtime_error(path + " is too large");
+    }
+    TiledLayout<T> layout = { static_cast<int>(header.rows), static_cast<int>(header.cols),
+                              static_cast<int>(header.tile) };
+    if (layout.tile <= 0)
+    {
+        throw std::runtime_error(path + " has no tile size");
+    }
+    return layout;
+}
+
+// creates (or truncates) path as a zero rows x cols matrix
+template<class T>
+TiledLayout<T> createTiledMatrix(const std::string& path, int rows, int cols, int tile)
+{
+    if (tile <= 0)
+    {
+        throw std::invalid_argument("tile size has to be positive");
+    }
+    TiledLayout<T> layout = { rows, cols, tile };
+    FileHandle file(path, O_RDWR | O_CREAT | O_TRUNC);
+    TiledMatrixHeader header = {};
+    std::memcpy(header.magic, tiledMatrixMagic, sizeof(header.magic));
+    header.version = tiledMatrixVersion;
+    header.dtype = static_cast<uint32_t>(DtypeOf<T>::value);
+    header.rows = rows;
+    header.cols = cols;
+    header.tile = tile;
+    writeFully(file.get(), &header, sizeof(header), 0, path);
+    // the tiles are zero until written, and take no disk space before
+    if (ftruncate(file.get(), static_cast<off_t>(layout.fileBytes())) != 0)
+    {
+        throw std::runtime_error("cannot resize " + path + ": " + std::strerror(errno));
+    }
+    return layout;
+}
+
+// whole, padded tile (i, j) into out
+template<class T>
+void readTile(int fd, const TiledLayout<T>& layout, int i, int j, T* out, const std::string& path)
+{
+    readFully(fd, out, layout.tileElements() * sizeof(T), layout.tileOffset(i, j), path);
+}
+
+template<class T>
+void writeTile(int fd, const TiledLayout<T>& layout, int i, int j, const T* in, const std::string& path)
+{
+    writeFully(fd, in, layout.tileElements() * sizeof(T), layout.tileOffset(i, j), path);
+}
+
+template<class T>
+void writeTiledMatrix(const std::string& path, MatrixView<const T> m, int tile)
+{
+    TiledLayout<T> layout = createTiledMatrix<T>(path, m.rows, m.cols, tile);
+    FileHandle file(path, O_RDWR);
+    AlignedBuffer<T> buffer(layout.tileElements());
+    for (int i = 0; i < layout.tilesDown(); ++i)
+    {
+        for (int j = 0; j < layout.tilesAcross(); ++j)
+        {
+            int rows = layout.tileRows(i), cols = layout.tileCols(j);
+            std::fill(buffer.data(), buffer.data() + layout.tileElements(), T());
+            assign(MatrixView<T>(buffer.data(), rows, cols, tile),
+                   m.block(i*tile, i*tile + rows, j*tile, j*tile + cols));
+            writeTile(file.get(), layout, i, j, buffer.data(), path);
+        }
+    }
+}
+
+// A tiled matrix file mapped into memory. Nothing is read up front, tiles
+// are paged in as their views are used.
+template<class T>
+class MappedMatrix
+{
+public:
+    explicit MappedMatrix(const std::string& path, bool writable = false)
+        : file(path, writable ? O_RDWR : O_RDONLY),
+          tiles(readTiledLayout<T>(file.get(), path))
+    {
+        struct stat info;
+        if (fstat(file.get(), &info) != 0)
+        {
+            throw std::runtime_error("cannot stat " + path + ": " + std::strerror(errno));
+        }
+        if (static_cast<size_t>(info.st_size) < tiles.fileBytes())
+        {
+            throw std::runtime_error("cannot read " + path + ": file is truncated");
+        }
+        mapping = MappedWindow(file.get(), 0, tiles.fileBytes(), writable, false);
+    }
+
+    const TiledLayout<T>& layout() const
+    {
+        return tiles;
+    }
+
+    MatrixView<const T> tile(int i, int j) const
+    {
+        return tileView(i, j);
+    }
+
+    // only for a mapping opened writable
+    MatrixView<T> tile(int i, int j)
+    {
+        return tileView(i, j);
+    }
+
+    // copy of the whole matrix
+    Matrix<T> toMatrix() const
+    {
+        Matrix<T> result(tiles.rows, tiles.cols);
+        for (int i = 0; i < tiles.tilesDown(); ++i)
+        {
+            for (int j = 0; j < tiles.tilesAcross(); ++j)
+            {
+                int row = i*tiles.tile, col = j*tiles.tile;
+                assign(result.view(row, row + tiles.tileRows(i), col, col + tiles.tileCols(j)), tile(i, j));
+            }
+        }
+        return result;
+    }
+private:
+    MatrixView<T> tileView(int i, int j) const
+    {
+        T* base = reinterpret_cast<T*>(mapping.as<char>() + tiles.tileOffset(i, j));
+        return MatrixView<T>(base, tiles.tileRows(i), tiles.tileCols(j), tiles.tile);
+    }
+
+    FileHandle file;
+    TiledLayout<T> tiles;
+    MappedWindow mapping;
+};
+
+#endif
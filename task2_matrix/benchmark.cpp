@@ -0,0 +1,745 @@
+#include <iostream>
+#include <sstream>
+#include <fstream>
+#include <string>
+#include <vector>
+#include <random>
+#include <algorithm>
+#include <functional>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <limits>
+#include <thread>
+#include <type_traits>
+
+#include <sys/resource.h>
+
+#include "ThreadPool.h"
+#include "Matrix.h"
+#include "Gemm.h"
+#include "ParallelGemm.h"
+#include "Strassen.h"
+#include "FixedMatrix.h"
+
+using namespace std;
+using namespace std::chrono;
+
+// Matrix product benchmark. The naive triple loop, the blocked GEMM, the
+// parallel GEMM and Strassen multiply square matrices over a list of sizes
+// (odd ones included, Strassen peels those), and the variants that run on
+// a pool also over a list of thread counts. Each point gets warm-up runs,
+// then timed repetitions, and reports the time to solution, GFLOP/s
+// counted as 2n^3 for every variant, and the peak resident set during its
+// runs. The last result is checked against a reference product: integers
+// have to match exactly, floating point results within a normwise bound.
+// Extra Strassen variants with a fixed crossover (--thresholds) show where
+// the crossover should be.
+//
+// Small matrices are measured as batches: --batch-count products of one
+// size from --batch-sizes, one FixedMatrix product after the other, and
+// as MatrixBatch on the calling thread and on the pool. Every product is
+// checked against FixedMatrix operator* the same way, and GFLOP/s counts
+// 2n^3 per product.
+//
+//   benchmark [--sizes 256,511,1024] [--threads 1,2,4] [--types int,double]
+//             [--thresholds 128,256] [--variants a,b] [--naive-max N]
+//             [--batch-sizes 4,8,32] [--batch-count N]
+//             [--reps N] [--warmup N] [--json]
+//
+// Output is CSV on stdout (--json for one JSON document); the exit status
+// is non-zero if any variant produced a wrong result.
+
+struct BenchmarkOptions
+{
+    std::vector<int> sizes = {128, 256, 511, 512, 1024, 2047, 2048};
+    std::vector<size_t> threads;
+    std::vector<std::string> types = {"int", "double"};
+    std::vector<int> thresholds;
+    std::vector<std::string> variants;
+    // the naive product is O(n^3) with no blocking, larger sizes take minutes
+    int naiveMaxSize = 512;
+    // small matrix sizes, each 4, 8, 16 or 32; a count of 0 skips batches
+    std::vector<int> batchSizes = {4, 8, 32};
+    size_t batchCount = 4096;
+    size_t reps = 5;
+    size_t warmup = 1;
+    bool json = false;
+};
+
+template<class T>
+struct Variant
+{
+    std::string name;
+    // runs with the thread count under test, otherwise on the calling
+    // thread and measured once per size
+    bool parallel;
+    int maxSize;
+    std::function<void(ThreadPool&, MatrixView<const T>, MatrixView<const T>, MatrixView<T>)> run;
+};
+
+struct Result
+{
+    std::string type;
+    std::string variant;
+    int size;
+    // products per run
+    size_t count;
+    size_t threads;
+    std::vector<double> ms;
+    double peakRssMb;
+    // peak above the resident set before the runs: the scratch of the variant
+    double extraRssMb;
+    double error;
+    bool ok;
+};
+
+// the textbook triple loop, one dot product per element
+template<class T>
+void naiveMultiply(MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c)
+{
+    for (int i = 0; i < a.rows; ++i)
+    {
+        for (int j = 0; j < b.cols; ++j)
+        {
+            T sum = T();
+            for (int k = 0; k < a.cols; ++k)
+            {
+                sum += a(i, k) * b(k, j);
+            }
+            c(i, j) = sum;
+        }
+    }
+}
+
+std::string baseName(const std::string& name)
+{
+    return name.substr(0, name.find('('));
+}
+
+template<class T>
+std::vector< Variant<T> > makeVariants(const BenchmarkOptions& options, int autoThreshold)
+{
+    int any = std::numeric_limits<int>::max();
+    std::vector< Variant<T> > variants;
+    variants.push_back({"naive", false, options.naiveMaxSize,
+                        [](ThreadPool&, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c)
+    {
+        naiveMultiply(a, b, c);
+    }});
+    variants.push_back({std::string("blocked(") + gemmIsaName(gemmIsa()) + ")", false, any,
+                        [](ThreadPool&, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c)
+    {
+        gemm(a, b, c);
+    }});
+    variants.push_back({"parallel", true, any,
+                        [](ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c)
+    {
+        gemm(pool, a, b, c);
+    }});
+    variants.push_back({"strassen(auto=" + std::to_string(autoThreshold) + ")", true, any,
+                        [](ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c)
+    {
+        strassen(pool, a, b, c);
+    }});
+    for (int threshold: options.thresholds)
+    {
+        variants.push_back({"strassen(t=" + std::to_string(threshold) + ")", true, any,
+                            [threshold](ThreadPool& pool, MatrixView<const T> a, MatrixView<const T> b, MatrixView<T> c)
+        {
+            StrassenOptions strassenOptions;
+            strassenOptions.threshold = threshold;
+            strassen(pool, a, b, c, strassenOptions);
+        }});
+    }
+
+    if (!options.variants.empty())
+    {
+        variants.erase(std::remove_if(variants.begin(), variants.end(), [&](const Variant<T>& variant)
+        {
+            return std::find(options.variants.begin(), options.variants.end(),
+                             baseName(variant.name)) == options.variants.end() &&
+                   std::find(options.variants.begin(), options.variants.end(),
+                             variant.name) == options.variants.end();
+        }), variants.end());
+    }
+    return variants;
+}
+
+std::vector<std::string> splitList(const std::string& list)
+{
+    std::vector<std::string> items;
+    std::stringstream stream(list);
+    std::string item;
+    while (std::getline(stream, item, ','))
+    {
+        if (!item.empty())
+        {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+std::vector<int> splitNumbers(const std::string& list)
+{
+    std::vector<int> numbers;
+    for (const std::string& item: splitList(list))
+    {
+        numbers.push_back(std::max(1, std::stoi(item)));
+    }
+    return numbers;
+}
+
+bool parseOptions(int argc, char* argv[], BenchmarkOptions& options)
+{
+    for (int i = 1; i < argc; ++i)
+    {
+        std::string arg = argv[i];
+        if (arg == "--json")
+        {
+            options.json = true;
+            continue;
+        }
+        if (i + 1 == argc)
+        {
+            return false;
+        }
+        std::string value = argv[++i];
+        if (arg == "--sizes")
+        {
+            options.sizes = splitNumbers(value);
+        }
+        else if (arg == "--threads")
+        {
+            options.threads.clear();
+            for (int threads: splitNumbers(value))
+            {
+                options.threads.push_back(threads);
+            }
+        }
+        else if (arg == "--types")
+        {
+            options.types = splitList(value);
+        }
+        else if (arg == "--thresholds")
+        {
+            options.thresholds = splitNumbers(value);
+        }
+        else if (arg == "--variants")
+        {
+            options.variants = splitList(value);
+        }
+        else if (arg == "--naive-max")
+        {
+            options.naiveMaxSize = std::stoi(value);
+        }
+        else if (arg == "--batch-sizes")
+        {
+            options.batchSizes = splitNumbers(value);
+        }
+        else if (arg == "--batch-count")
+        {
+            options.batchCount = std::stoul(value);
+        }
+        else if (arg == "--reps")
+        {
+            options.reps = std::max<size_t>(1, std::stoul(value));
+        }
+        else if (arg == "--warmup")
+        {
+            options.warmup = std::stoul(value);
+        }
+        else
+        {
+            return false;
+        }
+    }
+
+    // default sweep: powers of two up to the hardware, and the hardware
+    if (options.threads.empty())
+    {
+        size_t hardware = std::max(1u, std::thread::hardware_concurrency());
+        for (size_t t = 1; t < hardware; t *= 2)
+        {
+            options.threads.push_back(t);
+        }
+        options.threads.push_back(hardware);
+    }
+    for (const std::string& type: options.types)
+    {
+        if (type != "int" && type != "float" && type != "double")
+        {
+            return false;
+        }
+    }
+    for (int n: options.batchSizes)
+    {
+        if (n != 4 && n != 8 && n != 16 && n != 32)
+        {
+            return false;
+        }
+    }
+    return !options.sizes.empty();
+}
+
+// a field of /proc/self/status in MB, 0 if there is none
+double procStatusMb(const std::string& field)
+{
+    std::ifstream status("/proc/self/status");
+    std::string line;
+    while (std::getline(status, line))
+    {
+        if (line.compare(0, field.size() + 1, field + ":") == 0)
+        {
+            return std::stod(line.substr(field.size() + 1)) / 1024;
+        }
+    }
+    return 0;
+}
+
+// restarts the peak at the current resident set (Linux 4.0 and later)
+void resetPeakRss()
+{
+    std::ofstream("/proc/self/clear_refs") << "5";
+}
+
+double peakRssMb()
+{
+    double peak = procStatusMb("VmHWM");
+    if (peak > 0)
+    {
+        return peak;
+    }
+    // no /proc: the peak of the whole run so far
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss / 1024.0;
+}
+
+// floats are checked against a product summed in double
+template<class T> struct Reference { typedef T type; };
+template<> struct Reference<float> { typedef double type; };
+
+template<class T>
+Matrix<typename Reference<T>::type> referenceProduct(const Matrix<T>& a, const Matrix<T>& b)
+{
+    typedef typename Reference<T>::type Wide;
+    Matrix<Wide> c(a.rows, b.cols);
+    for (int i = 0; i < a.rows; ++i)
+    {
+        Wide* out = c.row(i);
+        for (int k = 0; k < a.cols; ++k)
+        {
+            Wide x = a(i, k);
+            const T* row = b.row(k);
+            for (int j = 0; j < b.cols; ++j)
+            {
+                out[j] += x * Wide(row[j]);
+            }
+        }
+    }
+    return c;
+}
+
+template<class T>
+double maxAbs(const Matrix<T>& m)
+{
+    double result = 0;
+    for (int i = 0; i < m.rows; ++i)
+    {
+        for (int j = 0; j < m.cols; ++j)
+        {
+            result = std::max(result, std::fabs(double(m(i, j))));
+        }
+    }
+    return result;
+}
+
+// Integers: the largest absolute difference, which has to be 0.
+// Floating point: the largest absolute difference over n max|a| max|b|,
+// the scale of the rounding error of any classical product; Strassen's
+// grows with its depth, the tolerance leaves room for that.
+template<class T, class W>
+double productError(const Matrix<W>& reference, const Matrix<T>& c, double scale)
+{
+    double error = 0;
+    for (int i = 0; i < c.rows; ++i)
+    {
+        for (int j = 0; j < c.cols; ++j)
+        {
+            error = std::max(error, std::fabs(double(c(i, j)) - double(reference(i, j))));
+        }
+    }
+    return std::is_integral<T>::value || scale == 0 ? error : error / scale;
+}
+
+template<class T>
+bool errorOk(double error)
+{
+    return std::is_integral<T>::value ? error == 0 : error <= 1024 * std::numeric_limits<T>::epsilon();
+}
+
+// nearest rank percentile of sorted times
+double percentile(const std::vector<double>& sorted, double q)
+{
+    return sorted[std::min(sorted.size() - 1, size_t(q*(sorted.size() - 1) + 0.5))];
+}
+
+double gflops(const Result& result)
+{
+    double n = result.size;
+    return 2*n*n*n * result.count / (percentile(result.ms, 0.5) * 1e-3) / 1e9;
+}
+
+template<class T>
+Result measure(const std::string& type, const Variant<T>& variant, ThreadPool& pool, size_t threads,
+               const Matrix<T>& a, const Matrix<T>& b, const Matrix<typename Reference<T>::type>& reference,
+               double scale, const BenchmarkOptions& options)
+{
+    Result result = {type, variant.name, a.rows, 1, threads, {}, 0, 0, 0, false};
+    Matrix<T> c(a.rows);
+    double before = procStatusMb("VmRSS");
+    resetPeakRss();
+    for (size_t rep = 0; rep < options.warmup + options.reps; ++rep)
+    {
+        // garbage in c, so a variant that leaves elements out is caught
+        for (int i = 0; i < c.rows; ++i)
+        {
+            std::fill(c.row(i), c.row(i) + c.cols, T(7));
+        }
+        steady_clock::time_point start = steady_clock::now();
+        variant.run(pool, a, b, c.view());
+        steady_clock::time_point end = steady_clock::now();
+        if (rep >= options.warmup)
+        {
+            result.ms.push_back(duration_cast<duration<double, std::milli> >(end - start).count());
+        }
+    }
+    result.peakRssMb = peakRssMb();
+    result.extraRssMb = before > 0 ? std::max(0.0, result.peakRssMb - before) : 0;
+    result.error = productError(reference, c, scale);
+    result.ok = errorOk<T>(result.error);
+    std::sort(result.ms.begin(), result.ms.end());
+    return result;
+}
+
+template<class T>
+void fillRandom(Matrix<T>& m, std::mt19937& gen)
+{
+    // small integers keep every integer product exact and far from overflow
+    std::uniform_int_distribution<int> integers(-8, 8);
+    std::uniform_real_distribution<double> reals(-1, 1);
+    for (int i = 0; i < m.rows; ++i)
+    {
+        for (int j = 0; j < m.cols; ++j)
+        {
+            m(i, j) = std::is_integral<T>::value ? T(integers(gen)) : T(reals(gen));
+        }
+    }
+}
+
+// the same products as FixedMatrix arrays and as batches, so each variant
+// runs on the layout it is made for
+template<class T, int N>
+struct BatchData
+{
+    explicit BatchData(size_t count)
+        : a(count), b(count), c(count), batchA(count), batchB(count), batchC(count) {}
+
+    std::vector< FixedMatrix<T, N> > a, b, c;
+    MatrixBatch<T, N> batchA, batchB, batchC;
+};
+
+template<class T, int N>
+struct BatchVariant
+{
+    std::string name;
+    bool parallel;
+    std::function<void(ThreadPool&, BatchData<T, N>&)> run;
+    // product m of the last run
+    std::function<FixedMatrix<T, N>(const BatchData<T, N>&, size_t)> product;
+};
+
+template<class T, int N>
+std::vector< BatchVariant<T, N> > makeBatchVariants(const BenchmarkOptions& options)
+{
+    std::vector< BatchVariant<T, N> > variants;
+    auto batchProduct = [](const BatchData<T, N>& data, size_t m) { return data.batchC.get(m); };
+    variants.push_back({"fixed", false, [](ThreadPool&, BatchData<T, N>& data)
+    {
+        for (size_t m = 0; m < data.a.size(); ++m)
+        {
+            data.c[m] = data.a[m] * data.b[m];
+        }
+    }, [](const BatchData<T, N>& data, size_t m) { return data.c[m]; }});
+    variants.push_back({std::string("batch(") + gemmIsaName(gemmIsa()) + ")", false,
+                        [](ThreadPool&, BatchData<T, N>& data)
+    {
+        multiplyBatch(data.batchA, data.batchB, data.batchC);
+    }, batchProduct});
+    variants.push_back({"batch-parallel", true, [](ThreadPool& pool, BatchData<T, N>& data)
+    {
+        multiplyBatch(pool, data.batchA, data.batchB, data.batchC);
+    }, batchProduct});
+
+    if (!options.variants.empty())
+    {
+        variants.erase(std::remove_if(variants.begin(), variants.end(), [&](const BatchVariant<T, N>& variant)
+        {
+            return std::find(options.variants.begin(), options.variants.end(),
+                             baseName(variant.name)) == options.variants.end() &&
+                   std::find(options.variants.begin(), options.variants.end(),
+                             variant.name) == options.variants.end();
+        }), variants.end());
+    }
+    return variants;
+}
+
+template<class T, int N>
+Result measureBatch(const std::string& type, const BatchVariant<T, N>& variant, ThreadPool& pool, size_t threads,
+                    BatchData<T, N>& data, const std::vector< FixedMatrix<T, N> >& reference,
+                    double scale, const BenchmarkOptions& options)
+{
+    Result result = {type, variant.name, N, data.a.size(), threads, {}, 0, 0, 0, false};
+    FixedMatrix<T, N> garbage;
+    std::fill(&garbage.data[0][0], &garbage.data[0][0] + N*N, T(7));
+    double before = procStatusMb("VmRSS");
+    resetPeakRss();
+    for (size_t rep = 0; rep < options.warmup + options.reps; ++rep)
+    {
+        for (size_t m = 0; m < data.c.size(); ++m)
+        {
+            data.c[m] = garbage;
+            data.batchC.set(m, garbage);
+        }
+        steady_clock::time_point start = steady_clock::now();
+        variant.run(pool, data);
+        steady_clock::time_point end = steady_clock::now();
+        if (rep >= options.warmup)
+        {
+            result.ms.push_back(duration_cast<duration<double, std::milli> >(end - start).count());
+        }
+    }
+    result.peakRssMb = peakRssMb();
+    result.extraRssMb = before > 0 ? std::max(0.0, result.peakRssMb - before) : 0;
+    double error = 0;
+    for (size_t m = 0; m < reference.size(); ++m)
+    {
+        FixedMatrix<T, N> c = variant.product(data, m);
+        for (int i = 0; i < N; ++i)
+        {
+            for (int j = 0; j < N; ++j)
+            {
+                error = std::max(error, std::fabs(double(c(i, j)) - double(reference[m](i, j))));
+            }
+        }
+    }
+    result.error = std::is_integral<T>::value || scale == 0 ? error : error / scale;
+    result.ok = errorOk<T>(result.error);
+    std::sort(result.ms.begin(), result.ms.end());
+    return result;
+}
+
+template<class T, int N>
+void benchmarkBatch(const std::string& type, const BenchmarkOptions& options, std::vector<Result>& results)
+{
+    std::vector< BatchVariant<T, N> > variants = makeBatchVariants<T, N>(options);
+    std::mt19937 gen(42);
+    BatchData<T, N> data(options.batchCount);
+    std::vector< FixedMatrix<T, N> > reference(options.batchCount);
+    double maxA = 0, maxB = 0;
+    for (size_t m = 0; m < options.batchCount; ++m)
+    {
+        Matrix<T> a(N), b(N);
+        fillRandom(a, gen);
+        fillRandom(b, gen);
+        maxA = std::max(maxA, maxAbs(a));
+        maxB = std::max(maxB, maxAbs(b));
+        for (int i = 0; i < N; ++i)
+        {
+            for (int j = 0; j < N; ++j)
+            {
+                data.a[m](i, j) = a(i, j);
+                data.b[m](i, j) = b(i, j);
+            }
+        }
+        data.batchA.set(m, data.a[m]);
+        data.batchB.set(m, data.b[m]);
+        reference[m] = data.a[m] * data.b[m];
+    }
+    double scale = N * maxA * maxB;
+
+    for (size_t t = 0; t < options.threads.size(); ++t)
+    {
+        size_t threads = options.threads[t];
+        ThreadPool pool(threads);
+        for (const BatchVariant<T, N>& variant: variants)
+        {
+            if (!variant.parallel && t > 0)
+            {
+                continue;
+            }
+            results.push_back(measureBatch(type, variant, pool, variant.parallel ? threads : 1,
+                                           data, reference, scale, options));
+            if (!results.back().ok)
+            {
+                cerr << variant.name << " gave a wrong " << type << " product for a batch of size " << N << endl;
+            }
+        }
+    }
+}
+
+template<class T>
+void benchmarkBatches(const std::string& type, const BenchmarkOptions& options, std::vector<Result>& results)
+{
+    if (options.batchCount == 0)
+    {
+        return;
+    }
+    for (int n: options.batchSizes)
+    {
+        switch (n)
+        {
+        case 4:
+            benchmarkBatch<T, 4>(type, options, results);
+            break;
+        case 8:
+            benchmarkBatch<T, 8>(type, options, results);
+            break;
+        case 16:
+            benchmarkBatch<T, 16>(type, options, results);
+            break;
+        default:
+            benchmarkBatch<T, 32>(type, options, results);
+            break;
+        }
+    }
+}
+
+template<class T>
+void benchmarkType(const std::string& type, const BenchmarkOptions& options,
+                   std::vector<Result>& results, std::vector< std::pair<std::string, int> >& thresholds)
+{
+    int autoThreshold;
+    {
+        // the crossover is measured once per type, not inside a timed run
+        ThreadPool pool(1);
+        autoThreshold = strassenThreshold<T>(pool);
+    }
+    thresholds.push_back(std::make_pair(type, autoThreshold));
+    std::vector< Variant<T> > variants = makeVariants<T>(options, autoThreshold);
+
+    std::mt19937 gen(42);
+    for (int n: options.sizes)
+    {
+        Matrix<T> a(n), b(n);
+        fillRandom(a, gen);
+        fillRandom(b, gen);
+        Matrix<typename Reference<T>::type> reference = referenceProduct(a, b);
+        double scale = n * maxAbs(a) * maxAbs(b);
+
+        for (size_t t = 0; t < options.threads.size(); ++t)
+        {
+            size_t threads = options.threads[t];
+            ThreadPool pool(threads);
+            for (const Variant<T>& variant: variants)
+            {
+                if (n > variant.maxSize || (!variant.parallel && t > 0))
+                {
+                    continue;
+                }
+                results.push_back(measure(type, variant, pool, variant.parallel ? threads : 1,
+                                          a, b, reference, scale, options));
+                if (!results.back().ok)
+                {
+                    cerr << variant.name << " gave a wrong " << type << " product for size " << n << endl;
+                }
+            }
+        }
+    }
+    benchmarkBatches<T>(type, options, results);
+}
+
+void printCsv(std::ostream& out, const std::vector<Result>& results)
+{
+    out << "type,variant,size,count,threads,reps,min_ms,median_ms,max_ms,gflops,peak_rss_mb,extra_rss_mb,error,ok\n";
+    for (const Result& result: results)
+    {
+        out << result.type << ',' << result.variant << ',' << result.size << ',' << result.count << ','
+            << result.threads << ','
+            << result.ms.size() << ',' << result.ms.front() << ',' << percentile(result.ms, 0.5) << ','
+            << result.ms.back() << ',' << gflops(result) << ',' << result.peakRssMb << ','
+            << result.extraRssMb << ',' << result.error << ',' << (result.ok ? "true" : "false") << '\n';
+    }
+}
+
+void printJson(std::ostream& out, const std::vector<Result>& results,
+               const std::vector< std::pair<std::string, int> >& thresholds, const BenchmarkOptions& options)
+{
+    out << "{\"isa\":\"" << gemmIsaName(gemmIsa()) << "\""
+        << ",\"hardware_threads\":" << std::thread::hardware_concurrency()
+        << ",\"reps\":" << options.reps << ",\"warmup\":" << options.warmup
+        << ",\"strassen_thresholds\":{";
+    for (size_t i = 0; i < thresholds.size(); ++i)
+    {
+        out << (i ? "," : "") << "\"" << thresholds[i].first << "\":" << thresholds[i].second;
+    }
+    out << "},\"results\":[";
+    for (size_t i = 0; i < results.size(); ++i)
+    {
+        const Result& result = results[i];
+        out << (i ? ",\n" : "\n")
+            << "{\"type\":\"" << result.type << "\",\"variant\":\"" << result.variant << "\""
+            << ",\"size\":" << result.size << ",\"count\":" << result.count
+            << ",\"threads\":" << result.threads
+            << ",\"min_ms\":" << result.ms.front() << ",\"median_ms\":" << percentile(result.ms, 0.5)
+            << ",\"max_ms\":" << result.ms.back() << ",\"gflops\":" << gflops(result)
+            << ",\"peak_rss_mb\":" << result.peakRssMb << ",\"extra_rss_mb\":" << result.extraRssMb
+            << ",\"error\":" << result.error << ",\"ok\":" << (result.ok ? "true" : "false") << "}";
+    }
+    out << "\n]}\n";
+}
+
+int main(int argc, char* argv[])
+{
+    BenchmarkOptions options;
+    if (!parseOptions(argc, argv, options))
+    {
+        cerr << "usage: " << argv[0] << " [--sizes 256,511,1024] [--threads 1,2,4] [--types int,float,double]"
+                " [--thresholds 128,256] [--variants a,b] [--naive-max N] [--batch-sizes 4,8,32]"
+                " [--batch-count N] [--reps N] [--warmup N] [--json]" << endl;
+        return 2;
+    }
+
+    std::vector<Result> results;
+    std::vector< std::pair<std::string, int> > thresholds;
+    for (const std::string& type: options.types)
+    {
+        if (type == "int")
+        {
+            benchmarkType<int32_t>(type, options, results, thresholds);
+        }
+        else if (type == "float")
+        {
+            benchmarkType<float>(type, options, results, thresholds);
+        }
+        else
+        {
+            benchmarkType<double>(type, options, results, thresholds);
+        }
+    }
+
+    if (options.json)
+    {
+        printJson(cout, results, thresholds, options);
+    }
+    else
+    {
+        printCsv(cout, results);
+    }
+
+    bool ok = std::all_of(results.begin(), results.end(), [](const Result& result) { return result.ok; });
+    return ok ? 0 : 1;
+}
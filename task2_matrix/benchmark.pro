@@ -0,0 +1,11 @@
+TEMPLATE = app
+TARGET = benchmark
+CONFIG += console c++11 release
+CONFIG -= app_bundle
+CONFIG -= qt
+
+SOURCES += benchmark.cpp
+
+# ThreadPool lives with task1
+INCLUDEPATH += ../task1
+CONFIG += thread
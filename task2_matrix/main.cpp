@@ -1,277 +1,239 @@
 #include <iostream>
-#include <iomanip>
+#include <string>
+#include <thread>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <climits>
+#include <stdexcept>
+
+#include <unistd.h>
+
+#include "ThreadPool.h"
+#include "Matrix.h"
+#include "Strassen.h"
+#include "ParallelGemm.h"
+#include "OutOfCoreGemm.h"
 
 using namespace std;
+using namespace std::chrono;
 
-
-class Matrix
+Matrix<int> pattern(int rows, int cols, int seed)
 {
-public:
-    Matrix(int n)
+    Matrix<int> m(rows, cols);
+    for (int i = 0; i < rows; ++i)
     {
-        this->n = n;
-        data = new int* [n];
-        for (int i = 0; i < n; ++i)
+        for (int j = 0; j < cols; ++j)
         {
-            data[i] = new int [n];
+            m(i, j) = (seed*i + j) % 7 - 3;
         }
     }
+    return m;
+}
 
-    ~Matrix()
-    {
-        for (int i = 0; i < n; ++i)
-        {
-            delete [] data[i];
-        }
-        delete [] data;
-    }
-
-    Matrix(Matrix const& m)
-        :Matrix(m.n)
-    {
-        *this = m;
-    }
-
-    Matrix(Matrix const& m, int rowStart, int rowEnd, int colStart, int colEnd)
-        :Matrix(rowEnd - rowStart)
-    {
-        for (int i = rowStart; i < rowEnd; ++i)
-        {
-            for (int j = colStart; j < colEnd; ++j)
-            {
-                (*this)(i-rowStart, j-colStart) = m(i, j);
-            }
-        }
-    }
-
-    void copyPart(Matrix const& m, int rowStart, int rowEnd, int colStart, int colEnd)
-    {
-        for (int i = rowStart; i < rowEnd; ++i)
-        {
-            for (int j = colStart; j < colEnd; ++j)
-            {
-                (*this)(rowStart, colStart) = m(i-rowStart, j-colStart);
-            }
-        }
-    }
-
-    Matrix& operator = (Matrix const& m)
-    {
-        if (this != &m)
-        {
-            for (int i = 0; i < n; ++i)
-            {
-                for (int j = 0; j < n; ++j)
-                {
-                    (*this)(i, j) = m(i, j);
-                }
-            }
-        }
-        return *this;
-    }
-
-    Matrix(Matrix && m)
-    {
-        this->data = m.data;
-    }
-
-    int& operator()(int i, int j)
-    {
-        return data[i][j];
-    }
-
-    int operator()(int i, int j) const
-    {
-        return data[i][j];
-    }
-
-    Matrix& operator=(Matrix && m)
-    {
-        if (this != &m)
-        {
-            this->data = m.data;
-        }
-        return *this;
-    }
-
-    Matrix operator*(const Matrix& m)
+template<class T>
+bool sameMatrix(const Matrix<T>& x, const Matrix<T>& y)
+{
+    if (x.rows != y.rows || x.cols != y.cols)
     {
-        Matrix result(m.n);
-        for (int i = 0; i < n; i++)
-        {
-            for (int j = 0; j < n; j++)
-            {
-                result(i, j) = 0;
-                for (int k = 0; k < n; k++)
-                {
-                    result(i,j) += (*this)(i, k) * m(k, j);
-                }
-            }
-        }
-        return result;
+        return false;
     }
-
-    Matrix& operator+=(Matrix& m)
+    for (int i = 0; i < x.rows; ++i)
     {
-        for (int i = 0; i < n; i++)
+        for (int j = 0; j < x.cols; ++j)
         {
-            for (int j = 0; j < n; j++)
+            if (x(i, j) != y(i, j))
             {
-                (*this)(i, j) += m(i, j);
+                return false;
             }
         }
-        return *this;
-    }
-
-    Matrix& operator-=(Matrix& m)
-    {
-        for (int i = 0; i < n; i++)
-        {
-            for (int j = 0; j < n; j++)
-            {
-                (*this)(i, j) -= m(i, j);
-            }
-        }
-        return *this;
     }
+    return true;
+}
 
-    Matrix operator+(Matrix&& m)
-    {
-        Matrix result(m);
-        return result += *this;
-    }
+// scratch file of the out-of-core checks
+std::string scratchPath(const std::string& name)
+{
+    const char* tmp = std::getenv("TMPDIR");
+    return std::string(tmp ? tmp : "/tmp") + "/" + name + "_" + std::to_string(getpid()) + ".tiled";
+}
 
-    Matrix operator+(Matrix& m)
-    {
-        Matrix result(m);
-        return result += *this;
-    }
+// rows x cols written tile by tile and mapped back
+bool checkRoundTrip(int rows, int cols, int tile)
+{
+    Matrix<int> m = pattern(rows, cols, 5);
+    std::string path = scratchPath("m");
+    writeTiledMatrix<int>(path, m.view(), tile);
+    bool ok = sameMatrix(MappedMatrix<int>(path).toMatrix(), m);
+    cout << "tiled file " << rows << "x" << cols << ", tile " << tile << ": " << (ok ? "ok" : "wrong") << endl;
+    std::remove(path.c_str());
+    return ok;
+}
 
-    Matrix operator-(Matrix&& m)
+// a header with more rows than an int holds has to be refused
+bool checkOversizedHeader()
+{
+    std::string path = scratchPath("big");
+    createTiledMatrix<int>(path, 1, 1, 8);
     {
-        Matrix result(m);
-        return -1*(result -= *this);
+        FileHandle file(path, O_RDWR);
+        TiledMatrixHeader header;
+        readFully(file.get(), &header, sizeof(header), 0, path);
+        header.rows = uint64_t(INT_MAX) + 1;
+        writeFully(file.get(), &header, sizeof(header), 0, path);
     }
-
-    Matrix operator-(Matrix& m)
+    bool ok = false;
+    try
     {
-        Matrix result(m);
-        return -1*(result -= *this);
+        MappedMatrix<int> mapped(path);
     }
-
-    friend Matrix operator*(int scalar, const Matrix& matrix)
+    catch (const std::runtime_error&)
     {
-        Matrix result(matrix);
-        for (int i = 0; i < result.n; i++)
-        {
-            for (int j = 0; j < result.n; j++)
-            {
-                result(i, j) *= scalar;
-            }
-        }
-        return result;
+        ok = true;
     }
+    cout << "tiled file with " << uint64_t(INT_MAX) + 1 << " rows: " << (ok ? "refused" : "accepted") << endl;
+    std::remove(path.c_str());
+    return ok;
+}
 
-    friend Matrix operator*(int scalar, const Matrix&& matrix)
+// a product written over one of its inputs has to be refused, the input
+// left as it was
+bool checkOutputIsInput(ThreadPool& pool)
+{
+    Matrix<int> a = pattern(9, 9, 2);
+    std::string path = scratchPath("in");
+    writeTiledMatrix<int>(path, a.view(), 4);
+    bool ok = false;
+    try
     {
-        Matrix result(matrix);
-        for (int i = 0; i < result.n; i++)
-        {
-            for (int j = 0; j < result.n; j++)
-            {
-                result(i, j) *= scalar;
-            }
-        }
-        return result;
+        outOfCoreMultiply<int>(pool, path, path, path);
     }
-
-    friend std::ostream& operator<< (std::ostream& stream, const Matrix& matrix)
+    catch (const std::invalid_argument&)
     {
-        for (int i = 0; i < matrix.n; i++)
-        {
-            for (int j = 0; j < matrix.n; j++)
-            {
-                stream << setw(3) << matrix(i, j);
-            }
-            stream << endl;
-        }
-        return stream;
+        ok = true;
     }
-public:
-    int n;
-    int scalar;
-private:
-    int** data;
-};
-
-
-/*
-     X           Y                X*Y
- +-------+   +-------+     +-------+-------+
- | A | B |   | E | F |     | AE+BG | AF+BH |
- +---+---+ * +---+---+  =  +-------+-------+
- | C | D |   | G | H |     | CE+DG | CF+DH |
- +---+---+   +---+---+     +---------------+
- Seven products:
- P1 = A(F-H)
- P2 = (A+B)H
- P3 = (C+D)E
- P4 = D(G-E)
- P5 = (A+D)(E+H)
- P6 = (B-D)(G+H)
- P7 = (A-C)(E+F)
-
-         +-------------+-------------+
-         | P5+P4-P2+P6 |    P1+P2    |
- X * Y = +-------------+-------------+
-         |    P3+P4    | P1+P5-P3+P7 |
-         +-------------+-------------+
-*/
+    ok = ok && sameMatrix(MappedMatrix<int>(path).toMatrix(), a);
+    cout << "out-of-core product onto its input: " << (ok ? "refused" : "accepted") << endl;
+    std::remove(path.c_str());
+    return ok;
+}
 
-Matrix strassen(const Matrix& left, const Matrix& right)
+// rows x inner times inner x cols through tiled files and bufferTiles tile
+// buffers; the product has to be exact and, with room for a row of A's
+// tiles and two more, every tile of A read once and B once per row of C
+bool checkOutOfCore(ThreadPool& pool, int rows, int inner, int cols, int tile, int bufferTiles)
 {
-    int n = left.n;
-    Matrix A(left, 0, n/2, 0, n/2);
-    Matrix B(left, 0, n/2, n/2, n);
-    Matrix C(left, n/2, n, 0, n/2);
-    Matrix D(left, n/2, n, n/2, n);
-
-    Matrix E(right, 0, n/2, 0, n/2);
-    Matrix F(right, 0, n/2, n/2, n);
-    Matrix G(right, n/2, n, 0, n/2);
-    Matrix H(right, n/2, n, n/2, n);
-
-    Matrix P1 = A*(F-H);
-    Matrix P2 = (A+B)*H;
-    Matrix P3 = (C+D)*E;
-    Matrix P4 = D*(G-E);
-    Matrix P5 = (A+D)*(E+H);
-    Matrix P6 = (B-D)*(G+H);
-    Matrix P7 = (A-C)*(E+F);
-
-    Matrix result(left.n);
-    result.copyPart(P5+P4-P2+P6, 0, n/2, 0, n/2);
-    result.copyPart(P1+P2, 0, n/2, n/2, n);
-    result.copyPart(P3+P4, n/2, n, 0, n/2);
-    result.copyPart(P1+P5-P3-P7, n/2, n, n/2, n);
-
-    return result;
+    Matrix<int> a = pattern(rows, inner, 2), b = pattern(inner, cols, 3);
+    std::string aPath = scratchPath("a"), bPath = scratchPath("b"), cPath = scratchPath("c");
+    writeTiledMatrix<int>(aPath, a.view(), tile);
+    writeTiledMatrix<int>(bPath, b.view(), tile);
+    size_t reads = outOfCoreMultiply<int>(pool, aPath, bPath, cPath, size_t(bufferTiles) * tile * tile * sizeof(int));
+    bool ok = sameMatrix(MappedMatrix<int>(cPath).toMatrix(), a*b);
+
+    int down = (rows + tile - 1) / tile, depth = (inner + tile - 1) / tile, across = (cols + tile - 1) / tile;
+    if (bufferTiles >= depth + 2)
+    {
+        ok = ok && reads == size_t(down) * depth * (1 + across);
+    }
+    cout << "out-of-core " << rows << "x" << inner << " * " << inner << "x" << cols << ", tile " << tile <<
+            ", " << bufferTiles << " buffers: " << reads << " tile reads, " << (ok ? "ok" : "wrong") << endl;
+    std::remove(aPath.c_str());
+    std::remove(bPath.c_str());
+    std::remove(cPath.c_str());
+    return ok;
 }
 
+
 int main()
 {
-    Matrix a(2);
+    Matrix<int> a(2);
     a(0, 0) = 1;
     a(0, 1) = 2;
     a(1, 0) = 3;
     a(1, 1) = 4;
-    Matrix b(2);
+    Matrix<int> b(2);
     b(0, 0) = 2;
     b(0, 1) = 0;
     b(1, 0) = 1;
     b(1, 1) = 2;
-    cout << strassen(a, b) << endl;
+    ThreadPool pool(std::thread::hardware_concurrency());
+    cout << strassen(pool, a, b) << endl;
 
-    return 0;
+    // odd sizes are peeled on the way down
+    int n = 2047;
+    Matrix<double> x(n), y(n);
+    for (int i = 0; i < n; ++i)
+    {
+        for (int j = 0; j < n; ++j)
+        {
+            x(i, j) = (i + j) % 10;
+            y(i, j) = (i * j) % 10;
+        }
+    }
+    high_resolution_clock::time_point start1 = high_resolution_clock::now();
+    Matrix<double> classical = x*y;
+    high_resolution_clock::time_point end1 = high_resolution_clock::now();
+    cout << "gemm " << n << "x" << n << " execution time " <<
+            duration_cast<milliseconds>( end1 - start1 ).count() << " milliseconds" << endl;
+
+    strassenThreshold<double>(pool);
+    high_resolution_clock::time_point start2 = high_resolution_clock::now();
+    Matrix<double> fast = strassen(pool, x, y);
+    high_resolution_clock::time_point end2 = high_resolution_clock::now();
+    cout << "strassen " << n << "x" << n << " (threshold " << strassenThreshold<double>(pool) <<
+            ") execution time " << duration_cast<milliseconds>( end2 - start2 ).count() << " milliseconds" << endl;
+    // small integers, so both products are exact
+    bool ok = sameMatrix(fast, classical);
+    // a measured threshold of n or more never recurses, so also force the
+    // peeled odd levels and the parallel products
+    StrassenOptions deep;
+    deep.threshold = 128;
+    ok = sameMatrix(strassen(pool, x, y, deep), classical) && ok;
+    cout << "strassen " << n << "x" << n << " against gemm: " << (ok ? "ok" : "wrong") << endl;
+
+    // rectangular and exact: classical GEMM, one thread against the pool
+    int rows = 3000, inner = 256, cols = 2000;
+    Matrix<int> p(rows, inner), q(inner, cols);
+    for (int i = 0; i < rows; ++i)
+    {
+        for (int j = 0; j < inner; ++j)
+        {
+            p(i, j) = (i + 2*j) % 7 - 3;
+        }
+    }
+    for (int i = 0; i < inner; ++i)
+    {
+        for (int j = 0; j < cols; ++j)
+        {
+            q(i, j) = (3*i + j) % 5 - 2;
+        }
+    }
+    high_resolution_clock::time_point start3 = high_resolution_clock::now();
+    Matrix<int> single = p*q;
+    high_resolution_clock::time_point end3 = high_resolution_clock::now();
+    Matrix<int> parallel = gemm(pool, p, q);
+    high_resolution_clock::time_point end4 = high_resolution_clock::now();
+    double singleMs = duration<double, std::milli>(end3 - start3).count();
+    double parallelMs = duration<double, std::milli>(end4 - end3).count();
+    cout << "gemm " << rows << "x" << inner << " * " << inner << "x" << cols << ": 1 thread " <<
+            singleMs << " ms, " << pool.size() << " threads " << parallelMs << " ms, speedup " <<
+            singleMs / parallelMs << endl;
+    bool same = sameMatrix(parallel, single);
+    cout << "gemm " << rows << "x" << inner << " * " << inner << "x" << cols << " on the pool against 1 thread: " <<
+            (same ? "ok" : "wrong") << endl;
+    ok = same && ok;
+
+    // odd shapes leave partial tiles at the edges, or fit in one tile
+    ok = checkRoundTrip(37, 53, 8) && checkRoundTrip(5, 3, 16) && checkOversizedHeader() && ok;
+    ok = checkOutputIsInput(pool) && ok;
+    ok = checkOutOfCore(pool, 37, 53, 29, 8, 4) && ok;
+    ok = checkOutOfCore(pool, 1, 17, 1, 8, 4) && ok;
+    ok = checkOutOfCore(pool, 5, 3, 7, 16, 4) && ok;
+    // an 8 x 8 grid of tiles, A's row fits from 10 buffers on
+    for (int buffers : {4, 10, 12, 16})
+    {
+        ok = checkOutOfCore(pool, 128, 128, 128, 16, buffers) && ok;
+    }
+    return ok ? 0 : 1;
 }
 
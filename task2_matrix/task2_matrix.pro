@@ -5,3 +5,7 @@ CONFIG -= qt
 
 SOURCES += main.cpp
 
+
+# ThreadPool lives with task1
+INCLUDEPATH += ../task1
+CONFIG += thread
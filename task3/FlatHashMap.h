@@ -0,0 +1,280 @@
+#ifndef FLAT_HASH_MAP_H
+#define FLAT_HASH_MAP_H
+
+#include <vector>
+#include <string>
+#include <memory>
+#include <utility>
+#include <cstring>
+#include <cstdint>
+#include <functional>
+
+// Hash map for the combine and reduce steps, which do little else than
+// look a key up and add to its value. All slots live in one array and a
+// collision moves on to the next slot (linear probing), so a lookup reads
+// one or two cache lines and an insert allocates nothing until the table
+// doubles. Every slot keeps the full hash of its key, most mismatches are
+// rejected without comparing keys.
+//
+// Keys the slot can't hold by value, std::string, are copied once into a
+// KeyArena that belongs to the map and freed all at once with it.
+
+// Bump allocator for key bytes. Blocks are never moved, so what store()
+// returns stays valid until clear() or the arena goes.
+class KeyArena
+{
+public:
+    const char* store(const char* data, size_t length)
+    {
+        // nothing to copy, and no block to point into before the first
+        if (length == 0)
+        {
+            return "";
+        }
+        if (length > _left)
+        {
+            if (length > blockSize / 4)
+            {
+                // a block of its own, keep filling the current one
+                _blocks.emplace_back(new char[length]);
+                return static_cast<const char*>(std::memcpy(_blocks.back().get(), data, length));
+            }
+            _blocks.emplace_back(new char[blockSize]);
+            _next = _blocks.back().get();
+            _left = blockSize;
+        }
+        char* result = _next;
+        std::memcpy(result, data, length);
+        _next += length;
+        _left -= length;
+        return result;
+    }
+
+    void clear()
+    {
+        _blocks.clear();
+        _next = nullptr;
+        _left = 0;
+    }
+private:
+    static const size_t blockSize = 64 * 1024;
+    std::vector<std::unique_ptr<char[]> > _blocks;
+    char* _next = nullptr;
+    size_t _left = 0;
+};
+
+// How a slot holds a Key: by value unless specialized.
+template <typename Key>
+struct FlatKey
+{
+    using Stored = Key;
+
+    static Stored store(const Key& key, KeyArena&)
+    {
+        return key;
+    }
+    static bool equals(const Stored& stored, const Key& key)
+    {
+        return stored == key;
+    }
+    static Key load(const Stored& stored)
+    {
+        return stored;
+    }
+};
+
+template <>
+struct FlatKey<std::string>
+{
+    struct Stored
+    {
+        const char* data;
+        size_t length;
+    };
+
+    static Stored store(const std::string& key, KeyArena& arena)
+    {
+        Stored stored = { arena.store(key.data(), key.size()), key.size() };
+        return stored;
+    }
+    static bool equals(const Stored& stored, const std::string& key)
+    {
+        return stored.length == key.size() &&
+               (key.empty() || std::memcmp(stored.data, key.data(), key.size()) == 0);
+    }
+    static std::string load(const Stored& stored)
+    {
+        return std::string(stored.data, stored.length);
+    }
+};
+
+template <typename Key, typename Value, typename Hash = std::hash<Key> >
+class FlatHashMap
+{
+public:
+    explicit FlatHashMap(size_t expected = 0)
+    {
+        reserve(expected);
+    }
+
+    // the value of key, inserted as value if key is new; second tells
+    // whether it was
+    std::pair<Value*, bool> emplace(const Key& key, const Value& value)
+    {
+        if (2 * (_size + 1) > _slots.size())
+        {
+            grow(2 * (_size + 1));
+        }
+        uint64_t hash = hashOf(key);
+        size_t index = hash & _mask;
+        for (;; index = (index + 1) & _mask)
+        {
+            Slot& slot = _slots[index];
+            if (slot.hash == hash && FlatKey<Key>::equals(slot.key, key))
+            {
+                return std::make_pair(&slot.value, false);
+            }
+            if (slot.hash == 0)
+            {
+                slot.hash = hash;
+                slot.key = FlatKey<Key>::store(key, _arena);
+                slot.value = value;
+                ++_size;
+                return std::make_pair(&slot.value, true);
+            }
+        }
+    }
+
+    Value& operator[](const Key& key)
+    {
+        return *emplace(key, Value()).first;
+    }
+
+    // nullptr if key isn't there
+    Value* find(const Key& key)
+    {
+        if (_size == 0)
+        {
+            return nullptr;
+        }
+        uint64_t hash = hashOf(key);
+        for (size_t index = hash & _mask;; index = (index + 1) & _mask)
+        {
+            Slot& slot = _slots[index];
+            if (slot.hash == hash && FlatKey<Key>::equals(slot.key, key))
+            {
+                return &slot.value;
+            }
+            if (slot.hash == 0)
+            {
+                return nullptr;
+            }
+        }
+    }
+
+    size_t size() const
+    {
+        return _size;
+    }
+
+    bool empty() const
+    {
+        return _size == 0;
+    }
+
+    // room for count keys without growing
+    void reserve(size_t count)
+    {
+        if (2 * count > _slots.size())
+        {
+            grow(2 * count);
+        }
+    }
+
+    // f(key, value) for every entry, in no particular order
+    template <typename F>
+    void forEach(F f)
+    {
+        for (Slot& slot : _slots)
+        {
+            if (slot.hash != 0)
+            {
+                f(FlatKey<Key>::load(slot.key), slot.value);
+            }
+        }
+    }
+
+    // appends every entry to out and empties the map
+    void drainTo(std::vector<std::pair<Key, Value> >& out)
+    {
+        out.reserve(out.size() + _size);
+        for (Slot& slot : _slots)
+        {
+            if (slot.hash != 0)
+            {
+                out.emplace_back(FlatKey<Key>::load(slot.key), std::move(slot.value));
+            }
+        }
+        clear();
+    }
+
+    void clear()
+    {
+        _slots.clear();
+        _mask = 0;
+        _size = 0;
+        _arena.clear();
+    }
+private:
+    struct Slot
+    {
+        // 0 marks an empty slot, a used one has the top bit set
+        uint64_t hash = 0;
+        typename FlatKey<Key>::Stored key;
+        Value value;
+    };
+
+    uint64_t hashOf(const Key& key) const
+    {
+        // std::hash of an integer is the integer itself, mix it so the
+        // low bits that pick the slot depend on all of it
+        uint64_t hash = _hasher(key);
+        hash ^= hash >> 33;
+        hash *= 0xff51afd7ed558ccdull;
+        hash ^= hash >> 33;
+        return hash | (uint64_t(1) << 63);
+    }
+
+    // at least count slots, a power of two; the entries move over
+    void grow(size_t count)
+    {
+        size_t capacity = 16;
+        while (capacity < count)
+        {
+            capacity *= 2;
+        }
+        std::vector<Slot> old(capacity);
+        old.swap(_slots);
+        _mask = capacity - 1;
+        for (Slot& slot : old)
+        {
+            if (slot.hash != 0)
+            {
+                size_t index = slot.hash & _mask;
+                while (_slots[index].hash != 0)
+                {
+                    index = (index + 1) & _mask;
+                }
+                _slots[index] = std::move(slot);
+            }
+        }
+    }
+
+    std::vector<Slot> _slots;
+    size_t _mask = 0;
+    size_t _size = 0;
+    KeyArena _arena;
+    Hash _hasher;
+};
+
+#endif // FLAT_HASH_MAP_H
@@ -0,0 +1,261 @@
+#ifndef INPUT_SOURCE_H
+#define INPUT_SOURCE_H
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <memory>
+#include <fstream>
+#include <istream>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include <cstring>
+#include <cerrno>
+#include <type_traits>
+#include <mutex>
+#include <condition_variable>
+
+#include "StreamScan.h"
+
+// Where a MapReduce job gets its records from. A source hands them out a
+// split at a time, and only when asked, so a job holds the splits in
+// flight and not the whole input. A split is a contiguous range of
+// records. Sources that can lend their records (a vector, a mapped file)
+// point into them, the others copy the split into storage of its own.
+
+template <typename DataT>
+struct Split
+{
+    const DataT* begin = nullptr;
+    const DataT* end = nullptr;
+    // the records, for a source that had to copy them
+    std::vector<DataT> records;
+    // the mapped part of a file, unmapped with the split
+    std::shared_ptr<MappedWindow> window;
+
+    size_t size() const
+    {
+        return end - begin;
+    }
+    // begin and end over records
+    void useRecords()
+    {
+        begin = records.data();
+        end = begin + records.size();
+    }
+};
+
+template <typename DataT>
+class InputSource
+{
+public:
+    virtual ~InputSource()
+    {
+    }
+    // up to count next records into split, false once there are none;
+    // only ever called from one thread at a time
+    virtual bool next(Split<DataT>& split, size_t count) = 0;
+};
+
+// the records of a vector, lent in place
+template <typename DataT>
+class VectorSource : public InputSource<DataT>
+{
+public:
+    explicit VectorSource(const std::vector<DataT>& data) :
+        _data(data),
+        _offset(0)
+    {
+    }
+    bool next(Split<DataT>& split, size_t count) override
+    {
+        if (_offset == _data.size())
+        {
+            return false;
+        }
+        size_t last = std::min(_data.size(), _offset + count);
+        split.begin = _data.data() + _offset;
+        split.end = _data.data() + last;
+        _offset = last;
+        return true;
+    }
+private:
+    const std::vector<DataT>& _data;
+    size_t _offset;
+};
+
+// the records of [first, last), any forward range; each split is a copy
+template <typename Iter>
+class IteratorSource : public InputSource<typename std::iterator_traits<Iter>::value_type>
+{
+public:
+    using DataT = typename std::iterator_traits<Iter>::value_type;
+
+    IteratorSource(Iter first, Iter last) :
+        _next(first),
+        _last(last)
+    {
+    }
+    bool next(Split<DataT>& split, size_t count) override
+    {
+        if (_next == _last)
+        {
+            return false;
+        }
+        split.records.clear();
+        for (; _next != _last && split.records.size() < count; ++_next)
+        {
+            split.records.push_back(*_next);
+        }
+        split.useRecords();
+        return true;
+    }
+private:
+    Iter _next;
+    Iter _last;
+};
+
+template <typename Iter>
+IteratorSource<Iter> makeIteratorSource(Iter first, Iter last)
+{
+    return IteratorSource<Iter>(first, last);
+}
+
+// the lines of a text stream or file, without their '\n'
+class LineSource : public InputSource<std::string>
+{
+public:
+    explicit LineSource(std::istream& in) :
+        _in(&in)
+    {
+    }
+    explicit LineSource(const std::string& path) :
+        _file(new std::ifstream(path)),
+        _in(_file.get())
+    {
+        if (!*_file)
+        {
+            throw std::runtime_error("cannot open " + path + ": " + std::strerror(errno));
+        }
+    }
+    bool next(Split<std::string>& split, size_t count) override
+    {
+        // getline straight into the strings of the split
+        split.records.resize(count);
+        size_t lines = 0;
+        while (lines < count && std::getline(*_in, split.records[lines]))
+        {
+            ++lines;
+        }
+        if (_in->bad())
+        {
+            throw std::runtime_error("cannot read the lines of the input");
+        }
+        split.records.resize(lines);
+        split.useRecords();
+        return lines > 0;
+    }
+private:
+    std::unique_ptr<std::ifstream> _file;
+    std::istream* _in;
+};
+
+// A raw native-endian binary file of DataT records. Each split maps just
+// its own part of the file, which is unmapped when the split is done, so
+// the mapped memory is that of the splits in flight.
+template <typename DataT>
+class MappedFileSource : public InputSource<DataT>
+{
+    static_assert(std::is_trivially_copyable<DataT>::value,
+                  "a mapped file holds plain records");
+public:
+    explicit MappedFileSource(const std::string& path) :
+        _file(path, O_RDONLY),
+        _offset(0),
+        _page(static_cast<size_t>(sysconf(_SC_PAGESIZE)))
+    {
+        struct stat info;
+        if (fstat(_file.get(), &info) != 0)
+        {
+            throw std::runtime_error("cannot stat " + path + ": " + std::strerror(errno));
+        }
+        _bytes = static_cast<size_t>(info.st_size) / sizeof(DataT) * sizeof(DataT);
+    }
+    bool next(Split<DataT>& split, size_t count) override
+    {
+        if (_offset == _bytes)
+        {
+            return false;
+        }
+        size_t length = std::min(_bytes - _offset, count * sizeof(DataT));
+        // mappings start on a page, the split where its records do
+        size_t start = _offset / _page * _page;
+        split.window = std::make_shared<MappedWindow>(_file.get(), start, _offset - start + length, false);
+        split.begin = reinterpret_cast<const DataT*>(split.window->template as<const char>() + (_offset - start));
+        split.end = split.begin + length / sizeof(DataT);
+        _offset += length;
+        return true;
+    }
+private:
+    FileHandle _file;
+    size_t _bytes;
+    size_t _offset;
+    size_t _page;
+};
+
+// Fixed capacity FIFO between threads. push() waits while it is full,
+// pop() while it is empty. After close() nothing gets in, and pop()
+// hands out what is left, then returns false.
+template <typename T>
+class BoundedQueue
+{
+public:
+    explicit BoundedQueue(size_t capacity) :
+        _capacity(std::max<size_t>(1, capacity)),
+        _closed(false)
+    {
+    }
+    // false if the queue was closed before item got in
+    bool push(T item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notFull.wait(lock, [this] { return _closed || _items.size() < _capacity; });
+        if (_closed)
+        {
+            return false;
+        }
+        _items.push_back(std::move(item));
+        _notEmpty.notify_one();
+        return true;
+    }
+    bool pop(T& item)
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _notEmpty.wait(lock, [this] { return _closed || !_items.empty(); });
+        if (_items.empty())
+        {
+            return false;
+        }
+        item = std::move(_items.front());
+        _items.pop_front();
+        _notFull.notify_one();
+        return true;
+    }
+    void close()
+    {
+        std::unique_lock<std::mutex> lock(_mutex);
+        _closed = true;
+        _notFull.notify_all();
+        _notEmpty.notify_all();
+    }
+private:
+    size_t _capacity;
+    bool _closed;
+    std::deque<T> _items;
+    std::mutex _mutex;
+    std::condition_variable _notFull;
+    std::condition_variable _notEmpty;
+};
+
+#endif // INPUT_SOURCE_H
@@ -0,0 +1,413 @@
+#ifndef MAP_REDUCE_H
+#define MAP_REDUCE_H
+
+#include <vector>
+#include <functional>
+#include <utility>
+#include <iterator>
+#include <cstddef>
+#include <algorithm>
+#include <mutex>
+#include <atomic>
+#include <exception>
+#include <stdexcept>
+
+#include "ThreadPool.h"
+#include "FlatHashMap.h"
+#include "InputSource.h"
+
+// A job: the input is read in splits and every split goes through the
+// mapper. A partitioner picks a reducer for each pair the mapper emits,
+// and the reducers' results are put together.
+//
+// Both phases run on a ThreadPool the caller keeps, so jobs pay no thread
+// start-up. The input comes from an InputSource (a vector, a mapped file,
+// the lines of a text file, an iterator range). The calling thread reads
+// it a split at a time into a BoundedQueue, and one mapping task per pool
+// thread takes the splits off the queue. Mapping starts with the first
+// split, and at most window() splits wait in the queue, so a job holds
+// about window() + pool size splits of input, however large the input
+// is. A thread done with its split takes the next one, so a split that
+// is slow to map does not hold the others back. There is one reducer per
+// pool thread. run() has to be called from outside the pool, whose
+// threads it keeps busy mapping until the input is read; called on one
+// of them it throws std::logic_error.
+//
+// The shuffle happens on the mapper side. Every mapping task has a row
+// of partition buffers, one per reducer, which nothing else writes, so
+// mapping needs no locking. Once every split is mapped, reducer r reads
+// column r, buffer r of every row, in place through a Partition, and no
+// pair is copied to a central place.
+//
+// A job may also have a combiner, which folds a value into the value
+// already seen for the same key. Each mapping task then folds the output
+// of all the splits it maps into one FlatHashMap, and only the table goes
+// through the shuffle, so a key is moved to its reducer once per task
+// however often it was emitted. The mapper can simply emit a pair per
+// record and leave the counting to the combiner.
+
+template <typename DataT, typename Key, typename Value>
+class MapReduce
+{
+public:
+    using ResT = std::vector<std::pair<Key, Value> >;
+    // a split is contiguous, wherever it comes from
+    using DataTIter = const DataT*;
+    class Partition;
+    using MapperT = std::function<ResT(DataTIter, DataTIter)>;
+    using ReducerT = std::function<ResT(const Partition&)>;
+    // folds the second value into the first, for the same key
+    using CombinerT = std::function<void(Value&, const Value&)>;
+    // the reducer of key, below reducers; run() throws std::out_of_range
+    // otherwise
+    using PartitionerT = std::function<size_t(const Key&, size_t reducers)>;
+
+    // The pairs one reducer gets, a column of partition buffers seen as
+    // one sequence.
+    class Partition
+    {
+    public:
+        class const_iterator
+        {
+        public:
+            using iterator_category = std::forward_iterator_tag;
+            using value_type = std::pair<Key, Value>;
+            using difference_type = std::ptrdiff_t;
+            using pointer = const value_type*;
+            using reference = const value_type&;
+
+            const_iterator(const std::vector<const ResT*>& buffers, size_t buffer, size_t index) :
+                _buffers(&buffers), _buffer(buffer), _index(index)
+            {
+                skipEmpty();
+            }
+            const std::pair<Key, Value>& operator*() const
+            {
+                return (*(*_buffers)[_buffer])[_index];
+            }
+            const std::pair<Key, Value>* operator->() const
+            {
+                return &**this;
+            }
+            const_iterator& operator++()
+            {
+                ++_index;
+                skipEmpty();
+                return *this;
+            }
+            const_iterator operator++(int)
+            {
+                const_iterator old = *this;
+                ++*this;
+                return old;
+            }
+            bool operator==(const const_iterator& other) const
+            {
+                return _buffer == other._buffer && _index == other._index;
+            }
+            bool operator!=(const const_iterator& other) const
+            {
+                return !(*this == other);
+            }
+        private:
+            // on to the next buffer when this one is used up
+            void skipEmpty()
+            {
+                while (_buffer < _buffers->size() && _index == (*_buffers)[_buffer]->size())
+                {
+                    ++_buffer;
+                    _index = 0;
+                }
+            }
+
+            const std::vector<const ResT*>* _buffers;
+            size_t _buffer;
+            size_t _index;
+        };
+
+        explicit Partition(std::vector<const ResT*> buffers) :
+            _buffers(std::move(buffers))
+        {
+        }
+        const_iterator begin() const
+        {
+            return const_iterator(_buffers, 0, 0);
+        }
+        const_iterator end() const
+        {
+            return const_iterator(_buffers, _buffers.size(), 0);
+        }
+        size_t size() const
+        {
+            size_t total = 0;
+            for (const ResT* buffer : _buffers)
+            {
+                total += buffer->size();
+            }
+            return total;
+        }
+        // the buffers themselves, one per mapping task
+        const std::vector<const ResT*>& buffers() const
+        {
+            return _buffers;
+        }
+    private:
+        std::vector<const ResT*> _buffers;
+    };
+public:
+    // splits per pool thread when no split size is set, for a vector
+    static const size_t splitsPerThread = 8;
+    // records per split when no split size is set, for other sources
+    static const size_t streamSplitSize = 64 * 1024;
+
+    MapReduce(ThreadPool& pool,
+              const std::vector<DataT>& data,
+              MapperT map,
+              ReducerT reducer,
+              CombinerT combiner = nullptr,
+              PartitionerT partitioner = nullptr) :
+        MapReduce(pool, &data, nullptr, map, reducer, combiner, partitioner)
+    {
+    }
+    // the source is read by run(), which consumes it
+    MapReduce(ThreadPool& pool,
+              InputSource<DataT>& source,
+              MapperT map,
+              ReducerT reducer,
+              CombinerT combiner = nullptr,
+              PartitionerT partitioner = nullptr) :
+        MapReduce(pool, nullptr, &source, map, reducer, combiner, partitioner)
+    {
+    }
+    // records per split, 0 picks a default
+    void setSplitSize(size_t splitSize)
+    {
+        _splitSize = splitSize;
+    }
+    size_t splitSize() const
+    {
+        if (_splitSize != 0)
+        {
+            return _splitSize;
+        }
+        if (_data)
+        {
+            return std::max<size_t>(1, _data->size() / (_pool.size() * splitsPerThread));
+        }
+        return streamSplitSize;
+    }
+    // splits read ahead of the mappers at most, 0 picks twice the pool size
+    void setWindow(size_t window)
+    {
+        _window = window;
+    }
+    size_t window() const
+    {
+        return _window != 0 ? _window : 2 * _pool.size();
+    }
+    // the default: by the hash of the key
+    static size_t hashPartitioner(const Key& key, size_t reducers)
+    {
+        return std::hash<Key>{}(key) % reducers;
+    }
+    // one pair per key of values, each key's values folded together
+    static ResT combine(const ResT& values, const CombinerT& combiner)
+    {
+        FlatHashMap<Key, Value> table;
+        combineInto(table, values, combiner);
+        ResT result;
+        table.drainTo(result);
+        return result;
+    }
+    ResT run()
+    {
+        if (_pool.is_worker())
+        {
+            throw std::logic_error("MapReduce::run called on a thread of its own pool");
+        }
+        size_t number_of_mappers = _pool.size();
+        size_t number_of_reducers = _pool.size();
+        std::vector<Mapper> mappers(number_of_mappers);
+        for (auto& mapper : mappers)
+        {
+            mapper.row.resize(number_of_reducers);
+        }
+
+        //map and shuffle, the splits go to whichever task is free
+        BoundedQueue< Split<DataT> > splits(window());
+        std::exception_ptr error;
+        std::mutex errorMutex;
+        std::atomic<bool> failed(false);
+        auto fail = [&]() {
+            std::unique_lock<std::mutex> lock(errorMutex);
+            if (!error)
+            {
+                error = std::current_exception();
+            }
+            failed = true;
+            splits.close();
+        };
+        Latch mapped(number_of_mappers);
+        for (size_t m = 0; m < number_of_mappers; ++m)
+        {
+            _pool.post([&, m]() {
+                try
+                {
+                    Split<DataT> split;
+                    while (splits.pop(split) && !failed)
+                    {
+                        mapSplit(split, mappers[m]);
+                    }
+                }
+                catch (...)
+                {
+                    fail();
+                }
+                mapped.count_down();
+            });
+        }
+        //read, while the first splits are mapped
+        try
+        {
+            std::vector<DataT> none;
+            VectorSource<DataT> whole(_data ? *_data : none);
+            InputSource<DataT>& source = _source ? *_source : whole;
+            size_t split_size = splitSize();
+            Split<DataT> split;
+            while (!failed && source.next(split, split_size) && splits.push(std::move(split)))
+            {
+                split = Split<DataT>();
+            }
+        }
+        catch (...)
+        {
+            fail();
+        }
+        splits.close();
+        _pool.wait(mapped);
+        if (error)
+        {
+            std::rethrow_exception(error);
+        }
+        if (_combiner)
+        {
+            _pool.parallel_for(size_t(0), number_of_mappers, size_t(1), [&](size_t m) {
+                ResT combined;
+                mappers[m].table.drainTo(combined);
+                partition(combined, mappers[m].row);
+            });
+        }
+        //reducer
+        std::vector<ResT> reducerResults(number_of_reducers);
+        _pool.parallel_for(size_t(0), number_of_reducers, size_t(1), [&](size_t r) {
+            std::vector<const ResT*> column;
+            for (auto& mapper : mappers)
+            {
+                column.push_back(&mapper.row[r]);
+            }
+            reducerResults[r] = _reducer(Partition(std::move(column)));
+        });
+        //combining results
+        ResT finalSolution;
+        for (auto& reducerRes : reducerResults)
+        {
+            finalSolution.insert( finalSolution.end(),
+                                  std::make_move_iterator(reducerRes.begin()),
+                                  std::make_move_iterator(reducerRes.end()) );
+        }
+        return finalSolution;
+    }
+private:
+    // what one mapping task has mapped so far
+    struct Mapper
+    {
+        // partition buffer of each reducer
+        std::vector<ResT> row;
+        // the combined output, with a combiner
+        FlatHashMap<Key, Value> table;
+    };
+
+    MapReduce(ThreadPool& pool,
+              const std::vector<DataT>* data,
+              InputSource<DataT>* source,
+              MapperT map,
+              ReducerT reducer,
+              CombinerT combiner,
+              PartitionerT partitioner) :
+        _pool(pool),
+        _data(data),
+        _source(source),
+        _map(map),
+        _reducer(reducer),
+        _combiner(combiner),
+        _partitioner(partitioner ? partitioner : hashPartitioner),
+        _splitSize(0),
+        _window(0)
+    {
+    }
+
+    void mapSplit(const Split<DataT>& split, Mapper& mapper) const
+    {
+        ResT mapRes = _map(split.begin, split.end);
+        if (_combiner)
+        {
+            combineInto(mapper.table, mapRes, _combiner);
+        }
+        else
+        {
+            partition(mapRes, mapper.row);
+        }
+    }
+
+    static void combineInto(FlatHashMap<Key, Value>& table, const ResT& values, const CombinerT& combiner)
+    {
+        for (auto& value : values)
+        {
+            auto slot = table.emplace(value.first, value.second);
+            if (!slot.second)
+            {
+                combiner(*slot.first, value.second);
+            }
+        }
+    }
+
+    // moves pairs into row, one buffer per reducer, grown once per call
+    void partition(ResT& pairs, std::vector<ResT>& row) const
+    {
+        std::vector<size_t> target(pairs.size());
+        std::vector<size_t> counts(row.size());
+        for (size_t p = 0; p < pairs.size(); ++p)
+        {
+            target[p] = _partitioner(pairs[p].first, row.size());
+            if (target[p] >= row.size())
+            {
+                throw std::out_of_range("the partitioner picked a reducer that does not exist");
+            }
+            ++counts[target[p]];
+        }
+        for (size_t r = 0; r < row.size(); ++r)
+        {
+            if (row[r].size() + counts[r] > row[r].capacity())
+            {
+                row[r].reserve(std::max(row[r].size() + counts[r], 2 * row[r].capacity()));
+            }
+        }
+        for (size_t p = 0; p < pairs.size(); ++p)
+        {
+            row[target[p]].push_back(std::move(pairs[p]));
+        }
+    }
+
+    ThreadPool& _pool;
+    // one of the two
+    const std::vector<DataT>* _data;
+    InputSource<DataT>* _source;
+    MapperT _map;
+    ReducerT _reducer;
+    CombinerT _combiner;
+    PartitionerT _partitioner;
+    size_t _splitSize;
+    size_t _window;
+};
+
+#endif // MAP_REDUCE_H
@@ -2,101 +2,126 @@
 #include <random>
 #include <algorithm>
 #include <vector>
-#include <functional>
+#include <string>
 #include <map>
+#include <chrono>
+#include <cmath>
 #include <thread>
-#include <future>
+#include <list>
+#include <fstream>
+#include <cstdio>
+#include <stdexcept>
+
+#include "MapReduce.h"
 
 using namespace std;
 
 
-template <typename DataT, typename Key, typename Value>
-class MapReduce
+using IntCountMapReduce = MapReduce<int,int,int>;
+
+// one pair per element, the combiner does the counting
+IntCountMapReduce::ResT mapper(IntCountMapReduce::DataTIter begin,
+                               IntCountMapReduce::DataTIter end)
 {
-public:
-    using ResT = vector<std::pair<Key, Value> >;
-    using DataTIter = typename vector<DataT>::const_iterator;
-    using MapperT = function<ResT(DataTIter, DataTIter)>;
-    using ReducerT = function<ResT(const ResT&)>;
-public:
-    MapReduce(const vector<DataT>& data,
-              MapperT map,
-              ReducerT reducer) :
-        _data(data),
-        _map(map),
-        _reducer(reducer)
-    {
-    }
-    ResT run()
-    {
-        //map
-        unsigned int number_of_threads = thread::hardware_concurrency();
-        unsigned int part_size = _data.size()/ number_of_threads;
-
-        std::vector< future<ResT> > mapResults;
-        for (int i = 0; i < number_of_threads; ++i)
-        {
-            auto partStart = _data.begin() + i*part_size;
-            auto partEnd = partStart + part_size;
-            mapResults.push_back(
-                        async(std::launch::async, _map, partStart, partEnd));
-        }
-        std::vector<ResT> shuffledArray(number_of_threads);
-        //shuffle
-        for (int i = 0; i < mapResults.size(); ++i)
+    IntCountMapReduce::ResT pairs;
+    pairs.reserve(end - begin);
+    for (auto it = begin; it != end; ++it)
+    {
+        pairs.emplace_back(*it, 1);
+    }
+    return pairs;
+}
+
+IntCountMapReduce::ResT reducer(const IntCountMapReduce::Partition& intermediate_values)
+{
+    FlatHashMap<int, int> counter;
+    for(auto& intermediate_value: intermediate_values)
+    {
+        counter[intermediate_value.first] += intermediate_value.second;
+    }
+    IntCountMapReduce::ResT result;
+    counter.drainTo(result);
+    return result;
+}
+
+void sum(int& total, const int& value)
+{
+    total += value;
+}
+
+// the values are small, spread them round robin
+size_t byValue(const int& key, size_t reducers)
+{
+    return size_t(key) % reducers;
+}
+
+using WordCountMapReduce = MapReduce<string,string,int>;
+
+WordCountMapReduce::ResT wordMapper(WordCountMapReduce::DataTIter begin,
+                                    WordCountMapReduce::DataTIter end)
+{
+    WordCountMapReduce::ResT pairs;
+    pairs.reserve(end - begin);
+    for (auto it = begin; it != end; ++it)
+    {
+        pairs.emplace_back(*it, 1);
+    }
+    return pairs;
+}
+
+// the space separated words of each line
+WordCountMapReduce::ResT lineMapper(WordCountMapReduce::DataTIter begin,
+                                    WordCountMapReduce::DataTIter end)
+{
+    WordCountMapReduce::ResT pairs;
+    for (auto it = begin; it != end; ++it)
+    {
+        size_t start = 0, space;
+        while ((space = it->find(' ', start)) != string::npos)
         {
-            ResT mapRes = mapResults[i].get();
-            for (auto& intermediate_value : mapRes)
+            if (space > start)
             {
-                int targedReducer = std::hash<Key>{}(intermediate_value.first) % number_of_threads;
-                shuffledArray[targedReducer].push_back(intermediate_value);
+                pairs.emplace_back(it->substr(start, space - start), 1);
             }
+            start = space + 1;
         }
-        //reducer
-        std::vector< future<ResT> > reducerResults;
-        for (int i = 0; i < number_of_threads; ++i)
-        {
-            reducerResults.push_back(
-                        async(std::launch::async, _reducer, cref(shuffledArray[i])));
-        }
-        //combining results
-        ResT finalSolution;
-        for (int i = 0; i < number_of_threads; ++i)
+        if (start < it->size())
         {
-            ResT reducerRes = reducerResults[i].get();
-            finalSolution.insert( finalSolution.end(),
-                                  reducerRes.begin(),
-                                  reducerRes.end() );
+            pairs.emplace_back(it->substr(start), 1);
         }
-        return finalSolution;
     }
-private:
-    const vector<DataT>& _data;
-    MapperT _map;
-    ReducerT _reducer;
-};
-
-using IntCountMapReduce = MapReduce<int,int,int>;
+    return pairs;
+}
 
-IntCountMapReduce::ResT mapper(IntCountMapReduce::DataTIter begin,
-                               IntCountMapReduce::DataTIter end)
+WordCountMapReduce::ResT wordReducer(const WordCountMapReduce::Partition& intermediate_values)
 {
-    map<int, int> counter;
-    for (auto it = begin; it != end; ++it)
+    FlatHashMap<string, int> counter;
+    for(auto& intermediate_value: intermediate_values)
     {
-        counter[*it] += 1;
+        counter[intermediate_value.first] += intermediate_value.second;
     }
-    return IntCountMapReduce::ResT(counter.begin(), counter.end());
+    WordCountMapReduce::ResT result;
+    counter.drainTo(result);
+    return result;
 }
 
-IntCountMapReduce::ResT reducer(const IntCountMapReduce::ResT& intermediate_values)
+// the words of data counted on one thread, for comparison
+template <typename Key>
+vector<pair<Key, int> > countSequential(const vector<Key>& data)
 {
-    map<int, int> counter;
-    for(auto& intermediate_value: intermediate_values)
+    map<Key, int> counter;
+    for (auto& item : data)
     {
-        counter[intermediate_value.first] += intermediate_value.second;
+        counter[item] += 1;
     }
-    return IntCountMapReduce::ResT(counter.begin(), counter.end());
+    return vector<pair<Key, int> >(counter.begin(), counter.end());
+}
+
+// notes one check in ok, which only stays true if every check passes
+bool track(bool& ok, bool same)
+{
+    ok = ok && same;
+    return same;
 }
 
 int main()
@@ -109,8 +134,12 @@ int main()
     vector<int> arr(size);
     generate(arr.begin(), arr.end(), [&](){return dis(gen);});
 
-    IntCountMapReduce mapReduce(arr, mapper, reducer);
+    // one pool for every job below
+    ThreadPool pool(max(1u, thread::hardware_concurrency()));
+
+    IntCountMapReduce mapReduce(pool, arr, mapper, reducer, sum, byValue);
     IntCountMapReduce::ResT result = mapReduce.run();
+    sort(result.begin(), result.end());
 
     cout << "parallel result" << endl;
     for (auto item : result)
@@ -119,12 +148,130 @@ int main()
     }
 
     cout << "expected result" << endl;
-    IntCountMapReduce::ResT checkResr = mapper(arr.begin(), arr.end());
+    IntCountMapReduce::ResT checkResr = countSequential(arr);
 
     for (auto item : checkResr)
     {
         cout << item.first << " " << item.second << endl;
     }
-    return 0;
-}
+    bool ok = result == checkResr;
+    cout << "int count: " << (ok ? "ok" : "WRONG") << endl;
 
+    // word count with many distinct words, with and without the combiner
+    uniform_int_distribution<> wordDis(0, 200000);
+    vector<string> words(size_t(1) << 22);
+    // a few words are empty, which is a key like any other
+    generate(words.begin(), words.end(), [&](){
+        int word = wordDis(gen);
+        return word == 0 ? string() : "word" + to_string(word);
+    });
+    WordCountMapReduce::ResT expected = countSequential(words);
+    for (bool combined : {false, true})
+    {
+        WordCountMapReduce wordCount(pool, words, wordMapper, wordReducer,
+                                     combined ? WordCountMapReduce::CombinerT(sum) : nullptr);
+        auto start = chrono::steady_clock::now();
+        WordCountMapReduce::ResT counts = wordCount.run();
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        sort(counts.begin(), counts.end());
+        cout << "word count " << (combined ? "with" : "without") << " combiner: "
+             << (track(ok, counts == expected) ? "ok" : "WRONG") << ", "
+             << elapsed.count() << " ms" << endl;
+    }
+
+    // empty words first, before the tables hold any other key
+    {
+        vector<string> few = {"", "", "a", "", "b", "a"};
+        WordCountMapReduce fewCount(pool, few, wordMapper, wordReducer, sum);
+        fewCount.setSplitSize(1);
+        WordCountMapReduce::ResT counts = fewCount.run();
+        sort(counts.begin(), counts.end());
+        cout << "empty word count: " << (track(ok, counts == countSequential(few)) ? "ok" : "WRONG") << endl;
+    }
+
+    // skewed input: the first eighth of the lines hold most of the words,
+    // so one part per thread would leave all but one thread waiting
+    vector<string> lines(size_t(1) << 18);
+    vector<string> lineWords;
+    for (size_t i = 0; i < lines.size(); ++i)
+    {
+        for (int w = 0; w < (i < lines.size() / 8 ? 32 : 1); ++w)
+        {
+            string word = "word" + to_string(wordDis(gen));
+            lines[i] += word + " ";
+            lineWords.push_back(word);
+        }
+    }
+    WordCountMapReduce::ResT lineExpected = countSequential(lineWords);
+    for (size_t splitSize : {lines.size() / pool.size(), size_t(0)})
+    {
+        WordCountMapReduce lineCount(pool, lines, lineMapper, wordReducer, sum);
+        lineCount.setSplitSize(splitSize);
+        auto start = chrono::steady_clock::now();
+        WordCountMapReduce::ResT counts = lineCount.run();
+        chrono::duration<double, milli> elapsed = chrono::steady_clock::now() - start;
+        sort(counts.begin(), counts.end());
+        cout << "skewed line word count, splits of " << lineCount.splitSize() << " lines: "
+             << (track(ok, counts == lineExpected) ? "ok" : "WRONG") << ", "
+             << elapsed.count() << " ms" << endl;
+    }
+
+    // the same jobs reading their input as they go: ints from a binary
+    // file, lines from a text file, ints from a list
+    const char* intPath = "mapreduce_ints.bin";
+    const char* linePath = "mapreduce_lines.txt";
+    vector<int> fileInts(size_t(1) << 20);
+    generate(fileInts.begin(), fileInts.end(), [&](){return dis(gen);});
+    {
+        ofstream out(intPath, ios::binary);
+        out.write(reinterpret_cast<const char*>(fileInts.data()), fileInts.size() * sizeof(int));
+        ofstream text(linePath);
+        for (auto& line : lines)
+        {
+            text << line << "\n";
+        }
+    }
+    {
+        MappedFileSource<int> source(intPath);
+        IntCountMapReduce fileCount(pool, source, mapper, reducer, sum);
+        IntCountMapReduce::ResT counts = fileCount.run();
+        sort(counts.begin(), counts.end());
+        cout << "mapped file count: " << (track(ok, counts == countSequential(fileInts)) ? "ok" : "WRONG") << endl;
+    }
+    {
+        LineSource source{string(linePath)};
+        WordCountMapReduce lineCount(pool, source, lineMapper, wordReducer, sum);
+        lineCount.setSplitSize(4096);
+        WordCountMapReduce::ResT counts = lineCount.run();
+        sort(counts.begin(), counts.end());
+        cout << "text file word count: " << (track(ok, counts == lineExpected) ? "ok" : "WRONG") << endl;
+    }
+    {
+        list<int> listInts(arr.begin(), arr.end());
+        auto source = makeIteratorSource(listInts.begin(), listInts.end());
+        IntCountMapReduce listCount(pool, source, mapper, reducer, sum);
+        listCount.setSplitSize(100);
+        IntCountMapReduce::ResT counts = listCount.run();
+        sort(counts.begin(), counts.end());
+        cout << "list count: " << (track(ok, counts == checkResr) ? "ok" : "WRONG") << endl;
+    }
+    remove(intPath);
+    remove(linePath);
+
+    // a partitioner past the last reducer fails the job
+    {
+        IntCountMapReduce badCount(pool, arr, mapper, reducer, nullptr,
+                                   [](const int&, size_t reducers) { return reducers; });
+        bool refused = false;
+        try
+        {
+            badCount.run();
+        }
+        catch (const out_of_range&)
+        {
+            refused = true;
+        }
+        cout << "partitioner out of range: " << (track(ok, refused) ? "refused" : "accepted") << endl;
+    }
+    return ok ? 0 : 1;
+}
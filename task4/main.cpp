@@ -6,6 +6,9 @@
 #include <future>
 #include <unistd.h>
 #include <chrono>
+#include <cmath>
+
+#include "ThreadPool.h"
 
 using namespace std::chrono;
 using namespace std;
@@ -94,7 +97,7 @@ PointAndDistance closest_pair_merge(Iter begin, Iter end, Iter mid, double d)
     return midDist;
 }
 
-PointAndDistance closest_pair_rec(Iter beginPx, Iter endPx, Iter beginPy, Iter endPy, int depth)
+PointAndDistance closest_pair_rec(ThreadPool* pool, Iter beginPx, Iter endPx, Iter beginPy, Iter endPy, int depth)
 {
     size_t size = endPx - beginPx;
     if (size <= 3)
@@ -116,18 +119,21 @@ PointAndDistance closest_pair_rec(Iter beginPx, Iter endPx, Iter beginPy, Iter e
     }
 
     PointAndDistance d;
-    if (depth >= 0 )
+    if (pool && depth >= 0 )
     {
-        auto dl = std::async(closest_pair_rec, beginPx, mid, Pyl.begin(), Pyl.end(), --depth);
-        auto dr = std::async(closest_pair_rec, mid, endPx, Pyr.begin(), Pyr.end(), --depth);
+        // left half goes to the pool, right half runs here; the wait keeps
+        // this thread busy with queued work until the left half is done
+        auto dl = pool->enqueue(closest_pair_rec, pool, beginPx, mid, Pyl.begin(), Pyl.end(), depth - 1);
+        auto dr = closest_pair_rec(pool, mid, endPx, Pyr.begin(), Pyr.end(), depth - 1);
 
-        d = std::min(dl.get(), dr.get());
+        pool->wait(dl);
+        d = std::min(dl.get(), dr);
     }
     else
     {
 
-        auto dl = closest_pair_rec(beginPx, mid, Pyl.begin(), Pyl.end(), -1);
-        auto dr = closest_pair_rec(mid, endPx, Pyr.begin(), Pyr.end(), -1);
+        auto dl = closest_pair_rec(nullptr, beginPx, mid, Pyl.begin(), Pyl.end(), -1);
+        auto dr = closest_pair_rec(nullptr, mid, endPx, Pyr.begin(), Pyr.end(), -1);
 
         d = std::min(dl, dr);
     }
@@ -143,9 +149,16 @@ PointAndDistance closest_pair(const std::vector<Point>& arr, int threads)
     sort(Px.begin(), Px.end(), [](const Point& l, const Point& r) { return l.x < r.x;});
     sort(Py.begin(), Py.end(), [](const Point& l, const Point& r) { return l.y < r.y;});
 
-    int depth = log2 (threads);
+    if (threads <= 0)
+    {
+        return closest_pair_rec(nullptr, Px.begin(), Px.end(), Py.begin(), Py.end(), -1);
+    }
+
+    // a few more tasks than threads so that stealing can even out the load
+    int depth = log2 (threads) + 2;
 
-    return closest_pair_rec(Px.begin(), Px.end(), Py.begin(), Py.end(), depth);
+    ThreadPool pool(threads);
+    return closest_pair_rec(&pool, Px.begin(), Px.end(), Py.begin(), Py.end(), depth);
 }
 
 